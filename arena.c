@@ -0,0 +1,127 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+// Starts a new chunk with room for at least size bytes
+static int grow(struct jz_arena *a, const size_t size)
+{
+    struct jz_arena_chunk *chunk;
+    size_t n = a->chunks ? a->chunks->size : JZ_ARENA_CHUNK / 2;
+
+    do {
+        if (n > (SIZE_MAX - sizeof(*chunk)) / 2)
+            return -1;
+        n *= 2;
+    } while (n < size);
+
+    if (!(chunk = malloc(sizeof(*chunk) + n)))
+        return -1;
+
+    chunk->next = a->chunks;
+    chunk->size = n;
+    a->chunks = chunk;
+    a->used = 0;
+    a->allocations++;
+    return 0;
+}
+
+static void free_chunks(struct jz_arena *a)
+{
+    struct jz_arena_chunk *chunk, *next;
+
+    for (chunk = a->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    a->chunks = NULL;
+}
+
+static void *arena_realloc(void *data, void *ptr, size_t old_size, size_t new_size)
+{
+    struct jz_arena *a = data;
+    void *p;
+
+    if (ptr && ptr == a->last) {
+        const size_t offset = (uint8_t *)ptr - a->chunks->data;
+
+        if (new_size <= a->chunks->size - offset) {
+            a->used = offset + new_size;
+            return ptr;
+        }
+    }
+
+    if (!(p = jz_arena_alloc(a, new_size)))
+        return NULL;
+    if (ptr)
+        memcpy(p, ptr, old_size < new_size ? old_size : new_size);
+    return p;
+}
+
+void jz_arena_init(struct jz_arena *a)
+{
+    assert(a);
+
+    a->chunks = NULL;
+    a->used = 0;
+    a->last = NULL;
+    a->allocations = 0;
+    a->allocator.realloc = arena_realloc;
+    a->allocator.free = NULL;
+    a->allocator.data = a;
+}
+
+void jz_arena_free(struct jz_arena *a)
+{
+    assert(a);
+
+    free_chunks(a);
+    a->used = 0;
+    a->last = NULL;
+}
+
+// Makes the whole arena free again. If it took several chunks, they are
+// replaced by one as large as all of them together, so that the same work
+// fits in one chunk the next time.
+void jz_arena_reset(struct jz_arena *a)
+{
+    size_t total = 0;
+
+    assert(a);
+
+    if (a->chunks && a->chunks->next) {
+        for (struct jz_arena_chunk *chunk = a->chunks; chunk; chunk = chunk->next)
+            total += chunk->size;
+        free_chunks(a);
+
+        // Without it, the next allocation starts over from a small chunk
+        grow(a, total);
+    }
+
+    a->used = 0;
+    a->last = NULL;
+}
+
+void *jz_arena_alloc(struct jz_arena *a, size_t size)
+{
+    size_t offset = (a->used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    void *p;
+
+    assert(a);
+
+    if (!a->chunks || offset > a->chunks->size || size > a->chunks->size - offset) {
+        if (grow(a, size) < 0)
+            return NULL;
+        offset = 0;
+    }
+
+    p = &a->chunks->data[offset];
+    a->used = offset + size;
+    a->last = p;
+    return p;
+}
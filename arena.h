@@ -0,0 +1,37 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vec.h"
+
+// Size of the first chunk, later ones double
+#define JZ_ARENA_CHUNK 4096
+
+struct jz_arena_chunk
+{
+    struct jz_arena_chunk *next;
+    size_t size;
+    _Alignas(max_align_t) uint8_t data[];
+};
+
+// Bump allocator for things that are all released at once. Vectors get their
+// storage from it through allocator, and freeing them does nothing.
+struct jz_arena
+{
+    struct jz_arena_chunk *chunks; // Newest first
+    size_t used;                   // Bytes of the newest chunk handed out
+    void *last;                    // Latest allocation, which can grow in place
+
+    size_t allocations; // Chunks allocated since jz_arena_init
+
+    struct vec_allocator allocator;
+};
+
+void jz_arena_init(struct jz_arena *a);
+void jz_arena_free(struct jz_arena *a);
+void jz_arena_reset(struct jz_arena *a);
+void *jz_arena_alloc(struct jz_arena *a, size_t size);
+
+#endif // ARENA_H_
@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <tokenizer.h>
+
+#include "bench.h"
+
+static struct bench_context ctx = { 0 };
+
+void bench_add_(const char *name, void (*callback)(void))
+{
+    if (!ctx.benches || ctx.capacity >= ctx.size) {
+        ctx.capacity += 64;
+        if (!(ctx.benches = realloc(ctx.benches, ctx.capacity * sizeof(*ctx.benches))))
+            exit(ENOMEM);
+    }
+
+    ctx.benches[ctx.size].name = name;
+    ctx.benches[ctx.size].callback = callback;
+    ctx.size++;
+}
+
+const char *bench_source =
+    "function update(state, action) {\n"
+    "    // Apply the action to a copy\n"
+    "    const next = { ...state, count: state.count + action.delta };\n"
+    "    if (next.count >= state.limit && !action.force) {\n"
+    "        return state;\n"
+    "    }\n"
+    "    /* caf\xc3\xa9 */ next.history = [...state.history, action];\n"
+    "    return next;\n"
+    "}\n";
+
+double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+uint8_t *bench_repeat(const char *snippet, size_t size, size_t *len)
+{
+    const size_t n = strlen(snippet);
+    uint8_t *buf;
+
+    *len = (size + n - 1) / n * n;
+    if (!(buf = malloc(*len + JZ_PADDING)))
+        exit(ENOMEM);
+
+    for (size_t i = 0; i < *len; i += n)
+        memcpy(&buf[i], snippet, n);
+    memset(&buf[*len], 0, JZ_PADDING);
+
+    return buf;
+}
+
+void bench_report(const char *name, size_t bytes, double seconds, double baseline)
+{
+    printf("  %-32s %9.1f MB/s", name, bytes / seconds / 1e6);
+    if (baseline > 0)
+        printf("  %5.2fx", baseline / seconds);
+    printf("\n");
+}
+
+// Runs the benchmarks whose name contains any of the arguments, or all of
+// them without arguments
+int main(int argc, char **argv)
+{
+    for (size_t i = 0; i < ctx.size; i++) {
+        int run = argc < 2;
+        for (int j = 1; j < argc; j++)
+            run |= strstr(ctx.benches[i].name, argv[j]) != NULL;
+        if (!run)
+            continue;
+
+        printf("%s\n", ctx.benches[i].name);
+        ctx.benches[i].callback();
+    }
+
+    free(ctx.benches);
+}
@@ -0,0 +1,49 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct bench_case
+{
+    const char *name;
+    void (*callback)(void);
+};
+
+struct bench_context
+{
+    struct bench_case *benches;
+    size_t capacity;
+    size_t size;
+};
+
+// Input size and number of timed passes for throughput benchmarks
+#define BENCH_SIZE (16 << 20)
+#define BENCH_RUNS 5
+
+#define BENCH_CASE_NAME_(name) BENCH_CASE_##name##_
+#define BENCH_WRAPPER_NAME_(name) BENCH_WRAPPER_##name##_
+
+#define BENCH(name)                                  \
+    void BENCH_CASE_NAME_(name)(void);               \
+    __attribute__((constructor))                     \
+    void BENCH_WRAPPER_NAME_(name)(void) {           \
+        bench_add_(#name, BENCH_CASE_NAME_(name)); } \
+    void BENCH_CASE_NAME_(name)(void)
+
+// Sample of typical source, for bench_repeat
+extern const char *bench_source;
+
+// Monotonic time in seconds
+double bench_now(void);
+
+// Builds a source of at least size bytes by repeating snippet, followed by
+// JZ_PADDING zero bytes
+uint8_t *bench_repeat(const char *snippet, size_t size, size_t *len);
+
+// Prints one result line, with throughput relative to baseline if nonzero
+void bench_report(const char *name, size_t bytes, double seconds, double baseline);
+
+void bench_add_(const char *name, void (*callback)(void));
+
+#endif // BENCH_H_
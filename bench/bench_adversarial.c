@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json.h>
+#include <token.h>
+#include <tokenizer.h>
+#include <vec.h>
+
+#include "bench.h"
+
+// Throughput on the larger input may drop to this fraction of the smaller one
+// before the cost per byte is taken to grow with the input
+#define ADVERSARIAL_MIN_RATIO 0.5
+
+// Both sizes are well past the caches, which would otherwise make the
+// smaller one look cheaper per byte
+#define ADVERSARIAL_SIZE (4 << 20)
+#define ADVERSARIAL_RUNS 3
+
+// Tokenizes with recovery and every feature that allocates, checking that
+// each token makes progress
+static void tokenize(const uint8_t *bytes, const size_t size)
+{
+    struct context ctx;
+    struct token tok;
+
+    jz_context_init(&ctx, bytes, size);
+    ctx.fingerprint.collect_statements = true;
+
+    do {
+        if (jz_next_token_fingerprint(&ctx, &tok) < 0) {
+            fprintf(stderr, "adversarial: failed at %zu\n", ctx.index);
+            exit(1);
+        }
+        vec_free(tok.id.str);
+    } while (tok.type != TOKEN_EOF);
+
+    jz_context_free(&ctx);
+}
+
+// Skips one body after another until one is unterminated, which the inputs
+// are meant to end with
+static void skip(const uint8_t *bytes, const size_t size)
+{
+    struct context ctx;
+
+    jz_context_init(&ctx, bytes, size);
+    while (ctx.index < size && jz_skip_balanced(&ctx) == 0)
+        ;
+}
+
+// Lexes until the end or the first invalid token, which is where malformed
+// inputs stop
+static void lex_json(const uint8_t *bytes, const size_t size)
+{
+    struct jz_json json;
+    struct token tok;
+
+    if (jz_json_init(&json, bytes, size) < 0) {
+        fprintf(stderr, "adversarial: out of memory\n");
+        exit(1);
+    }
+
+    while (jz_json_next_token(&json, &tok) == 0 && tok.type != TOKEN_EOF)
+        ;
+
+    jz_json_free(&json);
+}
+
+// Inputs made of prefix, then repeat as many times as fits, then suffix, and
+// the lexer they are passed to
+static const struct
+{
+    void (*pass)(const uint8_t *bytes, size_t size);
+    const char *name;
+    const char *prefix;
+    const char *repeat;
+    const char *suffix;
+} inputs[] = {
+    { tokenize, "long identifier",          "",     "a",       "" },
+    { tokenize, "escaped identifier",       "",     "\\u0061", "" },
+    { tokenize, "leading zeros",            "\\u{", "0",       "61}" },
+    { tokenize, "long hex escape",          "\\u{", "1",       "}" },
+    { tokenize, "backslashes",              "",     "\\",      "" },
+    { tokenize, "huge number",              "",     "1",       "" },
+    { tokenize, "unterminated string",      "'",    "a",       "" },
+    { tokenize, "unterminated strings",     "",     "'a\n",    "" },
+    { tokenize, "unterminated comment",     "/*",   "*",       "" },
+    { tokenize, "nested templates",         "",     "`${",     "" },
+    { tokenize, "template substitutions",   "`",    "${a}",    "`" },
+    { tokenize, "nested brackets",          "",     "({[",     "" },
+    { tokenize, "errors",                   "",     "@",       "" },
+
+    { skip,     "skip nested braces",       "",     "{",       "" },
+    { skip,     "skip nested parens",       "",     "(",       "" },
+    { skip,     "skip substitutions",       "`",    "${a}",    "` }" },
+    { skip,     "skip long regex",          "/",    "a",       "/ }" },
+    { skip,     "skip regex class",         "/[",   "/",       "]/ }" },
+    { skip,     "skip long string",         "'",    "a",       "' }" },
+    { skip,     "skip escapes",             "'",    "\\'",     "' }" },
+    { skip,     "skip regexes",             "",     "x = /}/ ", "}" },
+    { skip,     "skip keywords",            "",     "return /}/ / a.return ", "}" },
+    { skip,     "skip bodies",              "",     "}",       "" },
+
+    { lex_json, "json nested arrays",       "",     "[",       "" },
+    { lex_json, "json long string",         "\"",   "a",       "\"" },
+    { lex_json, "json escapes",             "\"",   "\\\\",    "\"" },
+    { lex_json, "json escaped quotes",      "\"",   "\\\"",    "\"" },
+    { lex_json, "json unterminated string", "\"",   "a",       "" },
+    { lex_json, "json huge number",         "",     "1",       "" },
+    { lex_json, "json many numbers",        "[",    "0,",      "0]" },
+};
+
+static uint8_t *build(const size_t i, const size_t size)
+{
+    const size_t prefix = strlen(inputs[i].prefix);
+    const size_t repeat = strlen(inputs[i].repeat);
+    const size_t suffix = strlen(inputs[i].suffix);
+    uint8_t *bytes = malloc(size + JZ_PADDING);
+    size_t len = 0;
+
+    if (!bytes)
+        exit(1);
+
+    memcpy(bytes, inputs[i].prefix, prefix);
+    for (len = prefix; len + repeat + suffix <= size; len += repeat)
+        memcpy(&bytes[len], inputs[i].repeat, repeat);
+    memcpy(&bytes[len], inputs[i].suffix, suffix);
+    len += suffix;
+
+    // Pad up to size with spaces, so both sizes are exact
+    memset(&bytes[len], ' ', size - len);
+    memset(&bytes[size], 0, JZ_PADDING);
+    return bytes;
+}
+
+// Best time of ADVERSARIAL_RUNS passes over input i
+static double run(const size_t i, const uint8_t *bytes, const size_t size)
+{
+    double best = 1e9;
+
+    for (int j = 0; j < ADVERSARIAL_RUNS; j++) {
+        double start = bench_now(), time;
+
+        inputs[i].pass(bytes, size);
+
+        time = bench_now() - start;
+        best = time < best ? time : best;
+    }
+
+    return best;
+}
+
+// Passes each input to its lexer at two sizes, and fails if the larger one is much
+// slower per byte. Throughput is reported for the larger one, relative to
+// the smaller one.
+BENCH(adversarial)
+{
+    const size_t small = ADVERSARIAL_SIZE;
+    const size_t large = ADVERSARIAL_SIZE * 4;
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(*inputs); i++) {
+        uint8_t *a = build(i, small);
+        uint8_t *b = build(i, large);
+        const double ta = run(i, a, small);
+        const double tb = run(i, b, large);
+        const double ratio = ta * (large / small) / tb;
+
+        bench_report(inputs[i].name, large, tb, ta * (large / small));
+        if (ratio < ADVERSARIAL_MIN_RATIO) {
+            fprintf(stderr, "adversarial: %s: cost per byte grows with size\n",
+                inputs[i].name);
+            failed = 1;
+        }
+
+        free(b);
+        free(a);
+    }
+
+    if (failed)
+        exit(1);
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json.h>
+#include <token.h>
+#include <tokenizer.h>
+#include <vec.h>
+
+#include "bench.h"
+
+// Source maps are mostly one long string of mappings, with short arrays of
+// names and sources around it
+static const char *json_source_map_head =
+    "{\"version\":3,\"file\":\"bundle.js\",\"sourceRoot\":\"\",\n"
+    " \"sources\":[\"src/index.js\",\"src/state.js\",\"src/caf\xc3\xa9.js\"],\n"
+    " \"names\":[\"update\",\"state\",\"action\",\"next\",\"count\",\"limit\"],\n"
+    " \"mappings\":\"";
+static const char *json_source_map_mappings =
+    "AAAA,SAASA,OAAOC,EAAOC;AACnB,MAAMC,GAAO,IAAKF,EAAOG,MAAOF,EAAOE;"
+    "AACxC,GAAID,EAAKC,OAASH,EAAMI,QAAUH,EAAO,CAAE;AACvC,OAAOD;AACT;";
+static const char *json_source_map_tail =
+    "\",\n \"x_offsets\":[0,-12,3.5e2,true,false,null]}\n";
+
+// One source map of about size bytes, followed by JZ_PADDING zero bytes
+static uint8_t *build_source_map(size_t size, size_t *len)
+{
+    const size_t head = strlen(json_source_map_head);
+    const size_t tail = strlen(json_source_map_tail);
+    size_t n;
+    uint8_t *mappings = bench_repeat(json_source_map_mappings, size, &n);
+    uint8_t *bytes;
+
+    *len = head + n + tail;
+    if (!(bytes = malloc(*len + JZ_PADDING)))
+        exit(1);
+
+    memcpy(bytes, json_source_map_head, head);
+    memcpy(&bytes[head], mappings, n);
+    memcpy(&bytes[head + n], json_source_map_tail, tail);
+    memset(&bytes[*len], 0, JZ_PADDING);
+
+    free(mappings);
+    return bytes;
+}
+
+// Package manifests and lockfiles have many short strings instead
+static const char *json_lockfile =
+    "{\"name\":\"@scope/pkg\",\"version\":\"1.2.3\",\n"
+    "  \"resolved\":\"https://registry.example.com/pkg/-/pkg-1.2.3.tgz\",\n"
+    "  \"integrity\":\"sha512-0123456789abcdef+/==\",\n"
+    "  \"dev\":true,\"dependencies\":{\"a\":\"^1.0.0\",\"b\":\"~2.1\"}},\n";
+
+static double time_json(const uint8_t *bytes, size_t len)
+{
+    double best = 1e9;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = bench_now();
+        struct jz_json json;
+        struct token tok;
+
+        if (jz_json_init(&json, bytes, len) < 0)
+            exit(1);
+        do {
+            if (jz_json_next_token(&json, &tok) < 0) {
+                fprintf(stderr, "json: failed at %zu\n", json.error_index);
+                exit(1);
+            }
+        } while (tok.type != TOKEN_EOF);
+        jz_json_free(&json);
+
+        double time = bench_now() - start;
+        best = time < best ? time : best;
+    }
+
+    return best;
+}
+
+// The JavaScript tokenizer reads strings and numbers as errors, so it needs
+// recovery to get through JSON at all
+static double time_javascript(const uint8_t *bytes, size_t len)
+{
+    double best = 1e9;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = bench_now();
+        struct context ctx;
+        struct token tok;
+
+        jz_context_init(&ctx, bytes, len);
+        do {
+            if (jz_next_token_recover(&ctx, &tok) < 0)
+                exit(1);
+            vec_free(tok.id.str);
+        } while (tok.type != TOKEN_EOF);
+        jz_context_free(&ctx);
+
+        double time = bench_now() - start;
+        best = time < best ? time : best;
+    }
+
+    return best;
+}
+
+static void report(const char *source, const uint8_t *bytes, size_t len)
+{
+    char name[64];
+    const double baseline = time_javascript(bytes, len);
+
+    snprintf(name, sizeof(name), "%s, jz_next_token_recover", source);
+    bench_report(name, len, baseline, 0);
+    snprintf(name, sizeof(name), "%s, jz_json_next_token", source);
+    bench_report(name, len, time_json(bytes, len), baseline);
+}
+
+BENCH(json)
+{
+    size_t len;
+    uint8_t *bytes;
+
+    bytes = build_source_map(BENCH_SIZE, &len);
+    report("source map", bytes, len);
+    free(bytes);
+
+    bytes = bench_repeat(json_lockfile, BENCH_SIZE, &len);
+    report("lockfile", bytes, len);
+    free(bytes);
+}
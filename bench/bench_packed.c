@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <packed.h>
+#include <token.h>
+#include <tokenizer.h>
+#include <vec.h>
+
+#include "bench.h"
+
+// Keeps every token of the input in a vector, payloads included, and
+// returns the bytes used
+static size_t keep_tokens(const uint8_t *bytes, size_t len)
+{
+    struct token *tokens = NULL;
+    struct context ctx;
+    struct token tok;
+    size_t used;
+
+    jz_context_init(&ctx, bytes, len);
+    do {
+        if (next_token(&ctx, &tok) < 0 || !vec_push(tokens, tok))
+            exit(1);
+    } while (tok.type != TOKEN_EOF);
+
+    used = vec_len(tokens) * sizeof(*tokens);
+    for (size_t i = 0; i < vec_len(tokens); i++) {
+        used += vec_cap(tokens[i].id.str);
+        vec_free(tokens[i].id.str);
+    }
+    vec_free(tokens);
+
+    return used;
+}
+
+static size_t keep_packed(const uint8_t *bytes, size_t len)
+{
+    struct jz_packed_tokens p;
+    struct context ctx;
+    size_t used;
+
+    jz_packed_init(&p);
+    jz_context_init(&ctx, bytes, len);
+    if (jz_pack_tokens(&p, &ctx, next_token) < 0)
+        exit(1);
+
+    used = vec_len(p.tokens) * sizeof(*p.tokens)
+        + vec_len(p.long_tokens) * sizeof(*p.long_tokens);
+    jz_packed_free(&p);
+
+    return used;
+}
+
+BENCH(packed)
+{
+    size_t len, used[2];
+    uint8_t *bytes = bench_repeat(bench_source, BENCH_SIZE, &len);
+    double times[2] = { 1e9, 1e9 };
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = bench_now(), time;
+
+        used[0] = keep_tokens(bytes, len);
+        time = bench_now() - start;
+        times[0] = time < times[0] ? time : times[0];
+
+        start = bench_now();
+        used[1] = keep_packed(bytes, len);
+        time = bench_now() - start;
+        times[1] = time < times[1] ? time : times[1];
+    }
+
+    bench_report("struct token", len, times[0], 0);
+    bench_report("struct jz_packed_token", len, times[1], times[0]);
+    printf("  %-32s %9.1f MB\n", "struct token, memory", used[0] / 1e6);
+    printf("  %-32s %9.1f MB  %5.2fx\n", "struct jz_packed_token, memory",
+        used[1] / 1e6, (double)used[0] / used[1]);
+
+    free(bytes);
+}
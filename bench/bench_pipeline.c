@@ -0,0 +1,115 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pipeline.h>
+#include <token.h>
+#include <tokenizer.h>
+#include <vec.h>
+
+#include "bench.h"
+
+// Stands in for a parser: hashes every identifier into a small table and
+// frees its payload
+struct consumer
+{
+    size_t counts[256];
+    uint64_t hash;
+};
+
+static void consume(struct consumer *c, const struct token *tok)
+{
+    uint64_t h = 0xcbf29ce484222325ull ^ tok->type;
+
+    for (size_t i = 0; i < tok->id.len; i++)
+        h = (h ^ tok->id.str[i]) * 0x100000001b3ull;
+
+    c->counts[h & 255]++;
+    c->hash ^= h;
+    vec_free(tok->id.str);
+}
+
+static double time_inline(const uint8_t *bytes, size_t len, struct consumer *c)
+{
+    double start = bench_now();
+    struct context ctx;
+    struct token tok;
+
+    jz_context_init(&ctx, bytes, len);
+    do {
+        if (next_token(&ctx, &tok) < 0)
+            exit(1);
+        consume(c, &tok);
+    } while (tok.type != TOKEN_EOF);
+
+    return bench_now() - start;
+}
+
+struct producer
+{
+    struct jz_pipeline *p;
+    struct context ctx;
+};
+
+static void *produce(void *data)
+{
+    struct producer *producer = data;
+
+    if (jz_pipeline_tokenize(producer->p, &producer->ctx, next_token) < 0)
+        exit(1);
+    return NULL;
+}
+
+static double time_pipelined(const uint8_t *bytes, size_t len, struct consumer *c)
+{
+    double start = bench_now();
+    const struct jz_batch *batch;
+    struct producer producer;
+    struct jz_pipeline p;
+    pthread_t thread;
+
+    if (jz_pipeline_init(&p, 64) < 0)
+        exit(1);
+    producer.p = &p;
+    jz_context_init(&producer.ctx, bytes, len);
+    if (pthread_create(&thread, NULL, produce, &producer) != 0)
+        exit(1);
+
+    while ((batch = jz_pipeline_pop(&p))) {
+        for (size_t i = 0; i < batch->count; i++)
+            consume(c, &batch->tokens[i]);
+        jz_pipeline_release(&p);
+    }
+
+    pthread_join(thread, NULL);
+    jz_pipeline_free(&p);
+
+    return bench_now() - start;
+}
+
+// Tokenizing and consuming on one thread, against tokenizing on a second
+// thread that hands tokens over through a pipeline
+BENCH(pipeline)
+{
+    size_t len;
+    uint8_t *bytes = bench_repeat(bench_source, BENCH_SIZE, &len);
+    struct consumer a = { 0 }, b = { 0 };
+    double baseline = 1e9, time = 1e9, t;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        if ((t = time_inline(bytes, len, &a)) < baseline)
+            baseline = t;
+        if ((t = time_pipelined(bytes, len, &b)) < time)
+            time = t;
+    }
+
+    if (a.hash != b.hash) {
+        fprintf(stderr, "pipeline: consumers disagree\n");
+        exit(1);
+    }
+
+    bench_report("inline", len, baseline, 0);
+    bench_report("pipelined", len, time, baseline);
+
+    free(bytes);
+}
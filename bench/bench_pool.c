@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <token.h>
+#include <tokenizer.h>
+#include <vec.h>
+
+#include "bench.h"
+
+// Tiny modules, tokenized one context per file
+#define POOL_FILES (1 << 17)
+
+static size_t tokenize(struct context *ctx)
+{
+    struct token tok;
+    size_t n = 0;
+
+    do {
+        if (jz_next_token_statements(ctx, &tok) < 0)
+            exit(1);
+        vec_free(tok.id.str);
+        n++;
+    } while (tok.type != TOKEN_EOF);
+
+    return n + vec_len(ctx->statements.starts);
+}
+
+static double time_fresh(const uint8_t *bytes, size_t len, size_t *sink)
+{
+    double best = 1e9;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = bench_now();
+
+        for (size_t i = 0; i < POOL_FILES; i++) {
+            struct context ctx;
+
+            jz_context_init(&ctx, bytes, len);
+            *sink += tokenize(&ctx);
+            jz_context_free(&ctx);
+        }
+
+        double time = bench_now() - start;
+        best = time < best ? time : best;
+    }
+
+    return best;
+}
+
+static double time_pool(const uint8_t *bytes, size_t len, size_t *sink)
+{
+    double best = 1e9;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = bench_now();
+
+        for (size_t i = 0; i < POOL_FILES; i++) {
+            struct context *ctx = jz_context_acquire(bytes, len);
+
+            if (!ctx)
+                exit(1);
+            *sink += tokenize(ctx);
+            jz_context_release(ctx);
+        }
+
+        double time = bench_now() - start;
+        best = time < best ? time : best;
+    }
+
+    jz_context_pool_clear();
+    return best;
+}
+
+BENCH(pool)
+{
+    const uint8_t *bytes = (const uint8_t *)bench_source;
+    const size_t len = strlen(bench_source);
+    size_t sink = 0;
+    const double baseline = time_fresh(bytes, len, &sink);
+
+    bench_report("jz_context_init per file", len * POOL_FILES, baseline, 0);
+    bench_report("jz_context_acquire per file", len * POOL_FILES,
+        time_pool(bytes, len, &sink), baseline);
+
+    if (sink == 0)
+        exit(1);
+}
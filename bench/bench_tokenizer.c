@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <token.h>
+#include <tokenizer.h>
+#include <vec.h>
+
+#include "bench.h"
+
+// Returns the best time of BENCH_RUNS passes over the whole input, with the
+// context set up by init
+#define TIME_VARIANT(fn, init) ({                                     \
+    double best_ = 1e9;                                               \
+    for (int run_ = 0; run_ < BENCH_RUNS; run_++) {                   \
+        struct context ctx_;                                          \
+        struct token tok_;                                            \
+        double start_ = bench_now();                                  \
+        init;                                                         \
+        do {                                                          \
+            if (fn(&ctx_, &tok_) < 0) {                               \
+                fprintf(stderr, #fn ": failed at %zu\n", ctx_.index); \
+                exit(1);                                              \
+            }                                                         \
+            vec_free(tok_.id.str);                                    \
+        } while (tok_.type != TOKEN_EOF);                             \
+        double time_ = bench_now() - start_;                          \
+        jz_context_free(&ctx_);                                       \
+        best_ = time_ < best_ ? time_ : best_;                        \
+    }                                                                 \
+    best_; })
+
+#define JZ_FEATURES_ENCODING (JZ_FEATURE_LATIN1 | JZ_FEATURE_UTF16)
+
+BENCH(tokenizer_variants)
+{
+    size_t len;
+    uint8_t *bytes = bench_repeat(bench_source, BENCH_SIZE, &len);
+    double baseline = 0;
+
+#define V(name, features)                               \
+    if (!((features) & JZ_FEATURES_ENCODING)) {         \
+        double time = TIME_VARIANT(name,                \
+            jz_context_init_padded(&ctx_, bytes, len)); \
+        bench_report(#name, len, time, baseline);       \
+        if (baseline == 0)                              \
+            baseline = time;                            \
+    }
+
+    JZ_TOKENIZER_LIST(V)
+
+#undef V
+
+    free(bytes);
+}
+
+// Each padded entry point against the same features without padding
+BENCH(tokenizer_padding)
+{
+    size_t len;
+    uint8_t *bytes = bench_repeat(bench_source, BENCH_SIZE, &len);
+    double baseline;
+
+    baseline = TIME_VARIANT(jz_next_token_span, jz_context_init(&ctx_, bytes, len));
+    bench_report("jz_next_token_span", len, baseline, 0);
+    bench_report("jz_next_token_span_padded", len,
+        TIME_VARIANT(jz_next_token_span_padded,
+            jz_context_init_padded(&ctx_, bytes, len)), baseline);
+
+    baseline = TIME_VARIANT(next_token, jz_context_init(&ctx_, bytes, len));
+    bench_report("next_token", len, baseline, 0);
+    bench_report("jz_next_token_padded", len,
+        TIME_VARIANT(jz_next_token_padded,
+            jz_context_init_padded(&ctx_, bytes, len)), baseline);
+
+    free(bytes);
+}
+
+// Decodes UTF-8 of at most three bytes per code point, which is all the
+// sample source has
+static size_t utf8_to_units(const uint8_t *bytes, size_t len, uint16_t *units)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; n++) {
+        if (bytes[i] < 0x80) {
+            units[n] = bytes[i++];
+        } else if (bytes[i] < 0xe0) {
+            units[n] = (bytes[i] & 0x1f) << 6 | (bytes[i + 1] & 0x3f);
+            i += 2;
+        } else {
+            units[n] = (bytes[i] & 0x0f) << 12 | (bytes[i + 1] & 0x3f) << 6
+                | (bytes[i + 2] & 0x3f);
+            i += 3;
+        }
+    }
+
+    return n;
+}
+
+static size_t units_to_utf8(const uint16_t *units, size_t n, uint8_t *bytes)
+{
+    size_t len = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (units[i] < 0x80) {
+            bytes[len++] = units[i];
+        } else if (units[i] < 0x800) {
+            bytes[len++] = 0xc0 | units[i] >> 6;
+            bytes[len++] = 0x80 | (units[i] & 0x3f);
+        } else {
+            bytes[len++] = 0xe0 | units[i] >> 12;
+            bytes[len++] = 0x80 | ((units[i] >> 6) & 0x3f);
+            bytes[len++] = 0x80 | (units[i] & 0x3f);
+        }
+    }
+
+    return len;
+}
+
+// Throughput is given in UTF-8 bytes for all encodings, so the numbers
+// compare the same source text
+BENCH(tokenizer_encodings)
+{
+    size_t len, n;
+    uint8_t *bytes = bench_repeat(bench_source, BENCH_SIZE, &len);
+    uint16_t *units = malloc(len * sizeof(*units));
+    uint8_t *latin1 = malloc(len);
+    uint8_t *transcoded = malloc(len * 3);
+    double baseline, time;
+
+    if (!units || !latin1 || !transcoded)
+        exit(1);
+
+    n = utf8_to_units(bytes, len, units);
+    for (size_t i = 0; i < n; i++)
+        latin1[i] = units[i];
+
+    baseline = TIME_VARIANT(next_token, jz_context_init(&ctx_, bytes, len));
+    bench_report("utf8", len, baseline, 0);
+
+    time = TIME_VARIANT(jz_next_token_latin1,
+        jz_context_init_latin1(&ctx_, latin1, n));
+    bench_report("latin1", len, time, baseline);
+
+    time = TIME_VARIANT(jz_next_token_utf16,
+        jz_context_init_utf16(&ctx_, units, n));
+    bench_report("utf16", len, time, baseline);
+
+    time = TIME_VARIANT(next_token,
+        jz_context_init(&ctx_, transcoded, units_to_utf8(units, n, transcoded)));
+    bench_report("utf16 transcoded to utf8", len, time, baseline);
+
+    free(transcoded);
+    free(latin1);
+    free(units);
+    free(bytes);
+}
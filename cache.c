@@ -0,0 +1,712 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "token.h"
+#include "tokenizer.h"
+#include "vec.h"
+
+// Number of buckets a cache starts with, doubled as entries are added
+#define CACHE_BUCKETS 64
+
+static const char file_magic[8] = "jztoken2";
+
+// Written before an entry in the directory store, followed by the input it
+// was made from, count struct file_token records and the payloads. Fields are
+// in host byte order, so files are only meant to be read back on the same
+// kind of machine.
+struct file_header
+{
+    char magic[8];
+    uint32_t record_size;
+    uint32_t token_count_max;
+    uint32_t error_count_max;
+    uint32_t byte_order;
+    struct jz_hash hash;
+    uint64_t size;
+    uint64_t count;
+    uint64_t payload_bytes;
+};
+
+// One token in the directory store, with no pointers or implicit padding
+struct file_token
+{
+    uint64_t start;
+    uint64_t end;
+    uint64_t line;
+    uint64_t column;
+    uint64_t trivia;
+    uint64_t id_len;
+    int32_t type;
+    int32_t error;
+    uint8_t newline_before;
+    uint8_t unused[7];
+};
+
+_Static_assert(sizeof(struct file_header) == 64, "file_header has padding");
+_Static_assert(sizeof(struct file_token) == 64, "file_token has padding");
+
+#define FILE_BYTE_ORDER 0x01020304u
+
+static const uint32_t error_count = 0
+#define F(x, s) + 1
+    JZ_ERROR_LIST(F)
+#undef F
+    ;
+
+static inline uint64_t rotl64(const uint64_t x, const int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+// MurmurHash3_x64_128, with lo and hi being the first and second halves of
+// the reference output
+struct jz_hash jz_hash128(const void *data, size_t size, uint64_t seed)
+{
+    const uint64_t c1 = 0x87c37b91114253d5ull;
+    const uint64_t c2 = 0x4cf5ad432745937full;
+    const uint8_t *bytes = data;
+    const size_t nblocks = size / 16;
+    const uint8_t *tail = &bytes[nblocks * 16];
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+    uint64_t k1, k2;
+
+    assert(data || size == 0);
+
+    for (size_t i = 0; i < nblocks; i++) {
+        memcpy(&k1, &bytes[i * 16], 8);
+        memcpy(&k2, &bytes[i * 16 + 8], 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    k1 = 0;
+    k2 = 0;
+
+    switch (size & 15) {
+    case 15: k2 ^= (uint64_t)tail[14] << 48; // fallthrough
+    case 14: k2 ^= (uint64_t)tail[13] << 40; // fallthrough
+    case 13: k2 ^= (uint64_t)tail[12] << 32; // fallthrough
+    case 12: k2 ^= (uint64_t)tail[11] << 24; // fallthrough
+    case 11: k2 ^= (uint64_t)tail[10] << 16; // fallthrough
+    case 10: k2 ^= (uint64_t)tail[9] << 8;   // fallthrough
+    case 9:
+        k2 ^= (uint64_t)tail[8];
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        // fallthrough
+    case 8: k1 ^= (uint64_t)tail[7] << 56; // fallthrough
+    case 7: k1 ^= (uint64_t)tail[6] << 48; // fallthrough
+    case 6: k1 ^= (uint64_t)tail[5] << 40; // fallthrough
+    case 5: k1 ^= (uint64_t)tail[4] << 32; // fallthrough
+    case 4: k1 ^= (uint64_t)tail[3] << 24; // fallthrough
+    case 3: k1 ^= (uint64_t)tail[2] << 16; // fallthrough
+    case 2: k1 ^= (uint64_t)tail[1] << 8;  // fallthrough
+    case 1:
+        k1 ^= (uint64_t)tail[0];
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= size;
+    h2 ^= size;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    return (struct jz_hash){ .lo = h1, .hi = h2 };
+}
+
+static void entry_free(struct jz_tokens *entry)
+{
+    vec_free((struct token *)entry->tokens);
+    free(entry->source);
+    vec_free(entry->payloads);
+    free(entry);
+}
+
+// Points identifier payloads into entry->payloads, where they are stored back
+// to back in token order. Fails if they would not fit.
+static int link_payloads(struct jz_tokens *entry)
+{
+    struct token *tokens = (struct token *)entry->tokens;
+    const size_t payload_bytes = vec_len(entry->payloads);
+    size_t offset = 0;
+
+    for (size_t i = 0; i < entry->count; i++) {
+        if (tokens[i].id.len == 0) {
+            tokens[i].id.str = NULL;
+            continue;
+        }
+        if (tokens[i].id.len > payload_bytes - offset)
+            return -1;
+        tokens[i].id.str = &entry->payloads[offset];
+        offset += tokens[i].id.len;
+    }
+
+    return 0;
+}
+
+static struct jz_tokens *entry_new(const struct jz_hash hash, const size_t size)
+{
+    struct jz_tokens *entry;
+
+    if (!(entry = calloc(1, sizeof(*entry))))
+        return NULL;
+
+    // Never empty, so that a NULL source means out of memory
+    if (!(entry->source = malloc(size > 0 ? size : 1))) {
+        free(entry);
+        return NULL;
+    }
+
+    entry->hash = hash;
+    entry->size = size;
+    return entry;
+}
+
+static void entry_finish(struct jz_tokens *entry)
+{
+    entry->count = vec_len(entry->tokens);
+    entry->bytes = sizeof(*entry) + entry->size
+        + vec_cap(entry->tokens) * sizeof(struct token)
+        + vec_cap(entry->payloads);
+}
+
+static bool entry_matches(const struct jz_tokens *entry, const struct jz_hash hash,
+    const uint8_t *bytes, const size_t size)
+{
+    return entry->hash.lo == hash.lo && entry->hash.hi == hash.hi
+        && entry->size == size && memcmp(entry->source, bytes, size) == 0;
+}
+
+// Tokenizes bytes with error recovery, so only running out of memory fails
+static struct jz_tokens *tokenize(const struct jz_hash hash, const uint8_t *bytes,
+    const size_t size)
+{
+    struct jz_tokens *entry;
+    struct token *tokens = NULL;
+    struct context ctx;
+    struct token tok;
+
+    if (!(entry = entry_new(hash, size)))
+        return NULL;
+    memcpy(entry->source, bytes, size);
+
+    jz_context_init(&ctx, bytes, size);
+
+    do {
+        if (jz_next_token_recover(&ctx, &tok) < 0)
+            goto fail;
+
+        if (tok.id.str) {
+            const int status = vec_append(entry->payloads, tok.id.str, tok.id.len);
+            vec_free(tok.id.str);
+            tok.id.str = NULL;
+            if (status < 0)
+                goto fail;
+        }
+
+        if (!vec_push(tokens, tok))
+            goto fail;
+    } while (tok.type != TOKEN_EOF);
+
+    jz_context_free(&ctx);
+
+    entry->tokens = tokens;
+    entry_finish(entry);
+    link_payloads(entry);
+    return entry;
+
+fail:
+    jz_context_free(&ctx);
+    vec_free(tokens);
+    entry_free(entry);
+    return NULL;
+}
+
+static char *entry_path(const struct jz_cache *cache, const struct jz_hash hash)
+{
+    const size_t len = strlen(cache->dir) + 1 + 32 + sizeof(".tok");
+    char *path;
+
+    if (!(path = malloc(len)))
+        return NULL;
+
+    snprintf(path, len, "%s/%016llx%016llx.tok", cache->dir,
+        (unsigned long long)hash.lo, (unsigned long long)hash.hi);
+    return path;
+}
+
+static int read_all(const int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len > 0) {
+        const ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int write_all(const int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0) {
+        const ssize_t n = write(fd, p, len);
+        if (n < 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+// Converts records read from the directory store into tokens, checking that
+// they could have come from tokenizing an input of entry->size bytes. Payloads
+// must add up to exactly what was read, and each one is null-terminated.
+static int read_tokens(struct jz_tokens *entry, const struct file_token *records,
+    const size_t count)
+{
+    struct token *tokens = (struct token *)entry->tokens;
+    const size_t payload_bytes = vec_len(entry->payloads);
+    size_t offset = 0, end = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const struct file_token *r = &records[i];
+
+        if (r->type < 0 || r->type >= TOKEN_COUNT
+            || r->error < 0 || (uint32_t)r->error >= error_count
+            || r->newline_before > 1
+            || r->trivia < end || r->trivia > r->start
+            || r->start > r->end || r->end > entry->size
+            || r->line == 0 || r->column > r->start)
+            return -1;
+        end = r->end;
+
+        if (r->id_len > 0) {
+            if (r->type != TOKEN_IDENTIFIER
+                || r->id_len > payload_bytes - offset
+                || entry->payloads[offset + r->id_len - 1] != '\0')
+                return -1;
+            offset += r->id_len;
+        }
+
+        tokens[i] = (struct token){
+            .type = r->type,
+            .start = r->start,
+            .end = r->end,
+            .line = r->line,
+            .column = r->column,
+            .trivia = r->trivia,
+            .newline_before = r->newline_before,
+            .id = { .len = r->id_len },
+            .error = r->error,
+        };
+    }
+
+    if (offset != payload_bytes || tokens[count - 1].type != TOKEN_EOF
+        || tokens[count - 1].start != entry->size)
+        return -1;
+
+    return link_payloads(entry);
+}
+
+// Reads the entry for bytes from the directory store. Files that are missing,
+// from a different build, damaged or made from other bytes with the same hash
+// are treated as misses.
+static struct jz_tokens *load(const struct jz_cache *cache, const struct jz_hash hash,
+    const uint8_t *bytes, const size_t size)
+{
+    struct jz_tokens *entry = NULL;
+    struct file_header header;
+    struct file_token *records = NULL;
+    struct token *tokens = NULL;
+    struct stat st;
+    uint64_t rest;
+    char *path;
+    int fd;
+
+    if (!(path = entry_path(cache, hash)))
+        return NULL;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd < 0)
+        return NULL;
+
+    if (read_all(fd, &header, sizeof(header)) < 0
+        || memcmp(header.magic, file_magic, sizeof(file_magic)) != 0
+        || header.record_size != sizeof(struct file_token)
+        || header.token_count_max != TOKEN_COUNT
+        || header.error_count_max != error_count
+        || header.byte_order != FILE_BYTE_ORDER
+        || header.hash.lo != hash.lo
+        || header.hash.hi != hash.hi
+        || header.size != size
+        || header.count == 0
+        || header.count > SIZE_MAX / sizeof(*records)
+        || header.payload_bytes > SIZE_MAX)
+        goto fail;
+
+    // Sizes are checked against the file before anything that large is
+    // allocated, as a damaged header may claim anything
+    if (fstat(fd, &st) < 0
+        || (uint64_t)st.st_size < sizeof(header) + size)
+        goto fail;
+    rest = st.st_size - sizeof(header) - size;
+    if (header.count > rest / sizeof(*records)
+        || header.payload_bytes != rest - header.count * sizeof(*records))
+        goto fail;
+
+    if (!(entry = entry_new(hash, size))
+        || read_all(fd, entry->source, size) < 0
+        || memcmp(entry->source, bytes, size) != 0)
+        goto fail;
+
+    if (!(records = malloc(header.count * sizeof(*records)))
+        || vec_resize(tokens, header.count) < 0
+        || vec_resize(entry->payloads, header.payload_bytes) < 0
+        || read_all(fd, records, header.count * sizeof(*records)) < 0
+        || read_all(fd, entry->payloads, header.payload_bytes) < 0)
+        goto fail;
+
+    entry->tokens = tokens;
+    tokens = NULL;
+    entry_finish(entry);
+    if (read_tokens(entry, records, header.count) < 0)
+        goto fail;
+
+    free(records);
+    close(fd);
+    return entry;
+
+fail:
+    close(fd);
+    free(records);
+    vec_free(tokens);
+    if (entry)
+        entry_free(entry);
+    return NULL;
+}
+
+// Writes an entry to the directory store. A temporary file is renamed into
+// place, so readers never see a partial entry. Failures are ignored, as the
+// store is only an optimization.
+static void store(const struct jz_cache *cache, const struct jz_tokens *entry)
+{
+    struct file_header header = {
+        .record_size = sizeof(struct file_token),
+        .token_count_max = TOKEN_COUNT,
+        .error_count_max = error_count,
+        .byte_order = FILE_BYTE_ORDER,
+        .hash = entry->hash,
+        .size = entry->size,
+        .count = entry->count,
+        .payload_bytes = vec_len(entry->payloads),
+    };
+    struct file_token *records;
+    char *path = NULL, *tmp = NULL;
+    int fd;
+
+    memcpy(header.magic, file_magic, sizeof(file_magic));
+
+    if (!(records = calloc(entry->count, sizeof(*records))))
+        return;
+
+    for (size_t i = 0; i < entry->count; i++) {
+        const struct token *tok = &entry->tokens[i];
+
+        records[i].start = tok->start;
+        records[i].end = tok->end;
+        records[i].line = tok->line;
+        records[i].column = tok->column;
+        records[i].trivia = tok->trivia;
+        records[i].id_len = tok->id.str ? tok->id.len : 0;
+        records[i].type = tok->type;
+        records[i].error = tok->type == TOKEN_ERROR ? tok->error : JZ_ERROR_NONE;
+        records[i].newline_before = tok->newline_before;
+    }
+
+    if (!(path = entry_path(cache, entry->hash))
+        || !(tmp = malloc(strlen(path) + sizeof(".XXXXXX"))))
+        goto out;
+
+    strcpy(tmp, path);
+    strcat(tmp, ".XXXXXX");
+    if ((fd = mkstemp(tmp)) < 0)
+        goto out;
+
+    if (write_all(fd, &header, sizeof(header)) < 0
+        || write_all(fd, entry->source, entry->size) < 0
+        || write_all(fd, records, entry->count * sizeof(*records)) < 0
+        || write_all(fd, entry->payloads, vec_len(entry->payloads)) < 0) {
+        close(fd);
+        unlink(tmp);
+        goto out;
+    }
+
+    if (close(fd) < 0 || rename(tmp, path) < 0)
+        unlink(tmp);
+
+out:
+    free(tmp);
+    free(path);
+    free(records);
+}
+
+int jz_cache_init(struct jz_cache *cache, size_t max_bytes, const char *dir)
+{
+    assert(cache);
+
+    memset(cache, 0, sizeof(*cache));
+    cache->max_bytes = max_bytes;
+
+    if (dir && !(cache->dir = strdup(dir)))
+        return -1;
+
+    if (!(cache->buckets = calloc(CACHE_BUCKETS, sizeof(*cache->buckets)))) {
+        free(cache->dir);
+        return -1;
+    }
+    cache->nbuckets = CACHE_BUCKETS;
+
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+        free(cache->buckets);
+        free(cache->dir);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Every token array from jz_cache_tokenize must have been released
+void jz_cache_free(struct jz_cache *cache)
+{
+    struct jz_tokens *entry, *next;
+
+    assert(cache);
+
+    for (entry = cache->head; entry; entry = next) {
+        next = entry->next;
+        assert(entry->refs == 1);
+        entry_free(entry);
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache->dir);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static struct jz_tokens **bucket(const struct jz_cache *cache, const struct jz_hash hash)
+{
+    return &cache->buckets[hash.lo & (cache->nbuckets - 1)];
+}
+
+static struct jz_tokens *lookup(struct jz_cache *cache, const struct jz_hash hash,
+    const uint8_t *bytes, const size_t size)
+{
+    struct jz_tokens *entry;
+
+    for (entry = *bucket(cache, hash); entry; entry = entry->chain) {
+        if (entry_matches(entry, hash, bytes, size))
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void lru_unlink(struct jz_cache *cache, struct jz_tokens *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void lru_push(struct jz_cache *cache, struct jz_tokens *entry)
+{
+    entry->next = cache->head;
+    if (cache->head)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+    cache->head = entry;
+}
+
+// Doubles the number of buckets, which is not needed for correctness, so
+// failing to allocate them is fine
+static void grow(struct jz_cache *cache)
+{
+    struct jz_tokens **old = cache->buckets;
+    const size_t nold = cache->nbuckets;
+    struct jz_tokens *entry, *next;
+
+    if (nold > SIZE_MAX / 2 / sizeof(*old)
+        || !(cache->buckets = calloc(nold * 2, sizeof(*old)))) {
+        cache->buckets = old;
+        return;
+    }
+    cache->nbuckets = nold * 2;
+
+    for (size_t i = 0; i < nold; i++) {
+        for (entry = old[i]; entry; entry = next) {
+            next = entry->chain;
+            entry->chain = *bucket(cache, entry->hash);
+            *bucket(cache, entry->hash) = entry;
+        }
+    }
+
+    free(old);
+}
+
+static void insert(struct jz_cache *cache, struct jz_tokens *entry)
+{
+    struct jz_tokens **p;
+
+    if (cache->stats.entries >= cache->nbuckets)
+        grow(cache);
+
+    p = bucket(cache, entry->hash);
+    entry->chain = *p;
+    *p = entry;
+    lru_push(cache, entry);
+
+    // One reference is held by the cache itself
+    entry->refs++;
+    cache->stats.entries++;
+    cache->stats.bytes += entry->bytes;
+}
+
+static void evict(struct jz_cache *cache, struct jz_tokens *entry)
+{
+    struct jz_tokens **p;
+
+    for (p = bucket(cache, entry->hash); *p != entry; p = &(*p)->chain)
+        ;
+    *p = entry->chain;
+    lru_unlink(cache, entry);
+
+    cache->stats.entries--;
+    cache->stats.bytes -= entry->bytes;
+    cache->stats.evictions++;
+
+    // Entries still in use are freed when they are released
+    if (--entry->refs == 0)
+        entry_free(entry);
+}
+
+// Returns the tokens of bytes, or NULL if out of memory. Identical inputs are
+// only tokenized once while they stay in the cache, and the result must be
+// given back with jz_cache_release.
+const struct jz_tokens *jz_cache_tokenize(struct jz_cache *cache,
+    const uint8_t *bytes, size_t size)
+{
+    const struct jz_hash hash = jz_hash128(bytes, size, 0);
+    struct jz_tokens *entry, *found;
+    bool loaded = false;
+
+    assert(cache && bytes);
+
+    pthread_mutex_lock(&cache->lock);
+    if ((entry = lookup(cache, hash, bytes, size))) {
+        lru_unlink(cache, entry);
+        lru_push(cache, entry);
+        entry->refs++;
+        cache->stats.hits++;
+        pthread_mutex_unlock(&cache->lock);
+        return entry;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    // Work on a miss is done unlocked, so other inputs are not held up
+    if (cache->dir && (entry = load(cache, hash, bytes, size)))
+        loaded = true;
+    else if ((entry = tokenize(hash, bytes, size)) && cache->dir)
+        store(cache, entry);
+
+    if (!entry)
+        return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    if (loaded)
+        cache->stats.disk_hits++;
+    else
+        cache->stats.misses++;
+
+    // Someone else may have added the same input meanwhile
+    if ((found = lookup(cache, hash, bytes, size))) {
+        entry_free(entry);
+        entry = found;
+    } else {
+        insert(cache, entry);
+    }
+    entry->refs++;
+
+    // The new entry is evicted as well if it does not fit on its own
+    while (cache->stats.bytes > cache->max_bytes && cache->tail)
+        evict(cache, cache->tail);
+
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+void jz_cache_release(struct jz_cache *cache, const struct jz_tokens *tokens)
+{
+    struct jz_tokens *entry = (struct jz_tokens *)tokens;
+
+    assert(cache && entry && entry->refs > 0);
+
+    pthread_mutex_lock(&cache->lock);
+    if (--entry->refs == 0)
+        entry_free(entry);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void jz_cache_get_stats(struct jz_cache *cache, struct jz_cache_stats *stats)
+{
+    assert(cache && stats);
+
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
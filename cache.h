@@ -0,0 +1,83 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "token.h"
+
+struct jz_hash
+{
+    uint64_t lo;
+    uint64_t hi;
+};
+
+// Tokens of one input, shared between everyone who asked for the same bytes.
+// Identifier payloads point into storage owned by the entry, so neither the
+// tokens nor their payloads may be modified or freed.
+struct jz_tokens
+{
+    struct jz_hash hash;
+    size_t size; // Size of the input in bytes
+
+    const struct token *tokens; // Ends with TOKEN_EOF
+    size_t count;
+
+    // Owned by the cache
+    size_t refs;
+    size_t bytes;
+    uint8_t *source; // Copy of the input, compared on every hit
+    uint8_t *payloads;
+    struct jz_tokens *chain;
+    struct jz_tokens *prev;
+    struct jz_tokens *next;
+};
+
+struct jz_cache_stats
+{
+    size_t hits;      // Found in memory
+    size_t disk_hits; // Found in the directory store
+    size_t misses;    // Tokenized
+    size_t evictions;
+
+    size_t entries;
+    size_t bytes;
+};
+
+// Tokens by a hash of the input bytes, kept in memory up to max_bytes with
+// the least recently used ones evicted first. The hash only narrows the
+// search: an entry is used only if its copy of the input matches the bytes
+// asked for, so inputs crafted to collide still get their own tokens. If dir is set, new entries are
+// also written there as files, and read back on a miss in memory. Safe to use
+// from several threads at once.
+struct jz_cache
+{
+    pthread_mutex_t lock;
+
+    size_t max_bytes;
+    char *dir;
+
+    // Hash table of entries, by hash.lo
+    struct jz_tokens **buckets;
+    size_t nbuckets;
+
+    // Most recently used first
+    struct jz_tokens *head;
+    struct jz_tokens *tail;
+
+    struct jz_cache_stats stats;
+};
+
+struct jz_hash jz_hash128(const void *data, size_t size, uint64_t seed);
+
+int jz_cache_init(struct jz_cache *cache, size_t max_bytes, const char *dir);
+void jz_cache_free(struct jz_cache *cache);
+
+const struct jz_tokens *jz_cache_tokenize(struct jz_cache *cache,
+    const uint8_t *bytes, size_t size);
+void jz_cache_release(struct jz_cache *cache, const struct jz_tokens *tokens);
+
+void jz_cache_get_stats(struct jz_cache *cache, struct jz_cache_stats *stats);
+
+#endif // CACHE_H_
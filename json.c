@@ -0,0 +1,496 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "json.h"
+
+#define JSON_BLOCK 64
+
+// Bits set for the bytes of one block that are of each kind
+struct json_block
+{
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op; // {}[]:,
+    uint64_t whitespace;
+};
+
+// State carried from one block to the next
+struct json_scanner
+{
+    uint64_t escaped;   // First byte of the next block is escaped
+    uint64_t in_string; // All ones if the next block starts inside a string
+    uint64_t scalar;    // Last byte was part of a number or literal
+};
+
+#ifdef __SSE2__
+static uint64_t movemask64(const __m128i m[4])
+{
+    return (uint64_t)(uint16_t)_mm_movemask_epi8(m[0])
+        | (uint64_t)(uint16_t)_mm_movemask_epi8(m[1]) << 16
+        | (uint64_t)(uint16_t)_mm_movemask_epi8(m[2]) << 32
+        | (uint64_t)(uint16_t)_mm_movemask_epi8(m[3]) << 48;
+}
+#endif
+
+static void find_quotes(const uint8_t *bytes, struct json_block *b)
+{
+#ifdef __SSE2__
+    __m128i quote[4], backslash[4];
+
+    for (int i = 0; i < 4; i++) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)&bytes[i * 16]);
+
+        quote[i] = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+        backslash[i] = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+    }
+
+    b->quote = movemask64(quote);
+    b->backslash = movemask64(backslash);
+#else
+    b->quote = b->backslash = 0;
+
+    for (int i = 0; i < JSON_BLOCK; i++) {
+        b->quote |= (uint64_t)(bytes[i] == '"') << i;
+        b->backslash |= (uint64_t)(bytes[i] == '\\') << i;
+    }
+#endif
+}
+
+static void find_structure(const uint8_t *bytes, struct json_block *b)
+{
+#ifdef __SSE2__
+    __m128i op[4], whitespace[4];
+
+    for (int i = 0; i < 4; i++) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)&bytes[i * 16]);
+
+        // Setting 0x20 folds [ onto { and ] onto }
+        const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+        op[i] = _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi8(lower, _mm_set1_epi8('{')),
+                _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+            _mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+        whitespace[i] = _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+            _mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+    }
+
+    b->op = movemask64(op);
+    b->whitespace = movemask64(whitespace);
+#else
+    b->op = b->whitespace = 0;
+
+    for (int i = 0; i < JSON_BLOCK; i++) {
+        switch (bytes[i]) {
+        case '{': case '}': case '[': case ']': case ':': case ',':
+            b->op |= 1ull << i;
+            break;
+        case ' ': case '\t': case '\n': case '\r':
+            b->whitespace |= 1ull << i;
+            break;
+        }
+    }
+#endif
+}
+
+// Bytes preceded by an odd number of backslashes. Runs starting on an odd
+// bit carry into the next even one when added to the backslashes, which
+// leaves a bit set after every run of odd length.
+static uint64_t find_escaped(struct json_scanner *s, uint64_t backslash)
+{
+    const uint64_t even = 0x5555555555555555ull;
+    uint64_t follows, odd_starts, sum;
+
+    backslash &= ~s->escaped;
+    follows = backslash << 1 | s->escaped;
+
+    odd_starts = backslash & ~even & ~follows;
+    s->escaped = __builtin_add_overflow(odd_starts, backslash, &sum);
+
+    return (even ^ sum << 1) & follows;
+}
+
+// Each bit becomes the XOR of itself and all the bits below it
+static uint64_t prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Offsets in the block that go into the index: structural characters, both
+// quotes of every string, and the first byte of every number or literal
+static uint64_t scan_block(struct json_scanner *s, const uint8_t *bytes)
+{
+    struct json_block b;
+    uint64_t quote, in_string, scalar, starts;
+
+    // Most of a source map is one long string, where nothing needs to be
+    // looked at until the next quote or backslash
+    find_quotes(bytes, &b);
+    if (s->in_string && !(b.quote | b.backslash)) {
+        s->escaped = 0;
+        return 0;
+    }
+
+    find_structure(bytes, &b);
+    quote = b.quote & ~find_escaped(s, b.backslash);
+
+    // Set from an opening quote up to, but not including, its closing one
+    in_string = prefix_xor(quote) ^ s->in_string;
+    s->in_string = (uint64_t)((int64_t)in_string >> 63);
+
+    scalar = ~(b.op | b.whitespace | quote | in_string);
+    starts = scalar & ~(scalar << 1 | s->scalar);
+    s->scalar = scalar >> 63;
+
+    return (b.op & ~in_string) | quote | starts;
+}
+
+// Writes the offsets of the bits set, four at a time whatever their number,
+// so up to three entries past the end are overwritten with garbage
+static void flatten(uint32_t *index, size_t *n, uint32_t base, uint64_t bits)
+{
+    const size_t count = __builtin_popcountll(bits);
+    uint32_t *out = &index[*n];
+
+    for (size_t i = 0; i < count; i += 4) {
+        // Set the top bit so that running out of bits is still defined
+        out[i] = base + __builtin_ctzll(bits | 1ull << 63);
+        bits &= bits - 1;
+        out[i + 1] = base + __builtin_ctzll(bits | 1ull << 63);
+        bits &= bits - 1;
+        out[i + 2] = base + __builtin_ctzll(bits | 1ull << 63);
+        bits &= bits - 1;
+        out[i + 3] = base + __builtin_ctzll(bits | 1ull << 63);
+        bits &= bits - 1;
+    }
+    *n += count;
+}
+
+int jz_json_init(struct jz_json *json, const uint8_t *bytes, size_t size)
+{
+    struct json_scanner s = { 0 };
+    uint8_t tail[JSON_BLOCK];
+    size_t i, n = 0;
+
+    assert(json && (bytes || size == 0));
+
+    json->bytes = bytes;
+    json->size = size;
+    json->index = NULL;
+    json->next = 0;
+    json->error = JZ_ERROR_NONE;
+    json->error_index = 0;
+
+    // Every byte may start a token, the size ends the index, and flatten
+    // writes past the end. This is not a vector, as those stop at 2^31
+    // entries.
+    if (size >= UINT32_MAX || size > SIZE_MAX / sizeof(*json->index) - 4
+        || !(json->index = malloc((size + 4) * sizeof(*json->index)))) {
+        json->error = JZ_ERROR_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    for (i = 0; i + JSON_BLOCK <= size; i += JSON_BLOCK)
+        flatten(json->index, &n, i, scan_block(&s, &bytes[i]));
+
+    // The rest is padded with whitespace, which is never indexed
+    if (i < size) {
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, &bytes[i], size - i);
+        flatten(json->index, &n, i, scan_block(&s, tail));
+    }
+
+    json->index[n++] = size;
+    return 0;
+}
+
+void jz_json_free(struct jz_json *json)
+{
+    assert(json);
+
+    free(json->index);
+    json->index = NULL;
+}
+
+// Length of the UTF-8 sequence at bytes, or 0 if it is not valid
+static size_t utf8_length(const uint8_t *bytes, const size_t avail)
+{
+    const uint8_t c = bytes[0];
+    size_t n;
+
+    if (c >= 0xc2 && c <= 0xdf)
+        n = 2;
+    else if (c >= 0xe0 && c <= 0xef)
+        n = 3;
+    else if (c >= 0xf0 && c <= 0xf4)
+        n = 4;
+    else
+        return 0;
+
+    if (avail < n)
+        return 0;
+    for (size_t i = 1; i < n; i++) {
+        if ((bytes[i] & 0xc0) != 0x80)
+            return 0;
+    }
+
+    // Overlong forms, surrogates and code points past U+10FFFF
+    if ((c == 0xe0 && bytes[1] < 0xa0) || (c == 0xed && bytes[1] > 0x9f)
+        || (c == 0xf0 && bytes[1] < 0x90) || (c == 0xf4 && bytes[1] > 0x8f))
+        return 0;
+
+    return n;
+}
+
+static bool is_hex(const uint8_t c)
+{
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+// Checks the contents of a string between its quotes, skipping 16 bytes at
+// a time that need no closer look. Returns the offset of the first invalid
+// byte, or end.
+static size_t validate_string(const uint8_t *bytes, size_t i, const size_t end)
+{
+    size_t n;
+
+    while (i < end) {
+#ifdef __SSE2__
+        while (i + 64 <= end) {
+            __m128i special[4];
+
+            // Bytes >= 0x80 are negative, so they count as control characters
+            for (int k = 0; k < 4; k++) {
+                const __m128i v = _mm_loadu_si128((const __m128i *)&bytes[i + k * 16]);
+
+                special[k] = _mm_or_si128(
+                    _mm_cmplt_epi8(v, _mm_set1_epi8(0x20)),
+                    _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+            }
+
+            const uint64_t mask = movemask64(special);
+            if (mask) {
+                i += __builtin_ctzll(mask);
+                break;
+            }
+            i += 64;
+        }
+        while (i + 16 <= end) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)&bytes[i]);
+            const unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmplt_epi8(v, _mm_set1_epi8(0x20)),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+
+            if (mask) {
+                i += __builtin_ctz(mask);
+                break;
+            }
+            i += 16;
+        }
+        if (i >= end)
+            break;
+#endif
+
+        if (bytes[i] == '\\') {
+            // The closing quote is not escaped, so there is a byte after it
+            switch (bytes[i + 1]) {
+            case '"': case '\\': case '/':
+            case 'b': case 'f': case 'n': case 'r': case 't':
+                i += 2;
+                break;
+            case 'u':
+                if (end - i < 6 || !is_hex(bytes[i + 2]) || !is_hex(bytes[i + 3])
+                    || !is_hex(bytes[i + 4]) || !is_hex(bytes[i + 5]))
+                    return i;
+                i += 6;
+                break;
+            default:
+                return i;
+            }
+        } else if (bytes[i] < 0x20) {
+            return i;
+        } else if (bytes[i] >= 0x80) {
+            if (!(n = utf8_length(&bytes[i], end - i)))
+                return i;
+            i += n;
+        } else {
+            i++;
+        }
+    }
+
+    return end;
+}
+
+static bool is_digit(const uint8_t c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Scans a number, returning its end, or start if it is malformed
+static size_t scan_number(const uint8_t *bytes, const size_t start, const size_t size)
+{
+    size_t i = start;
+
+#define DIGITS()                                \
+    do {                                        \
+        if (i >= size || !is_digit(bytes[i]))   \
+            return start;                       \
+        while (i < size && is_digit(bytes[i]))  \
+            i++;                                \
+    } while (0)
+
+    if (bytes[i] == '-')
+        i++;
+    if (i < size && bytes[i] == '0')
+        i++;
+    else
+        DIGITS();
+
+    if (i < size && bytes[i] == '.') {
+        i++;
+        DIGITS();
+    }
+
+    if (i < size && (bytes[i] | 0x20) == 'e') {
+        i++;
+        if (i < size && (bytes[i] == '+' || bytes[i] == '-'))
+            i++;
+        DIGITS();
+    }
+
+#undef DIGITS
+
+    return i;
+}
+
+// Whether a number or literal may end right before offset i
+static bool is_delimiter(const struct jz_json *json, const size_t i)
+{
+    if (i == json->size)
+        return true;
+
+    switch (json->bytes[i]) {
+    case '{': case '}': case '[': case ']': case ':': case ',': case '"':
+    case ' ': case '\t': case '\n': case '\r':
+        return true;
+    }
+
+    return false;
+}
+
+// Scans true, false or null, returning its end, or start if the input has
+// anything else
+static size_t scan_literal(const struct jz_json *json, const size_t start,
+    const char *str)
+{
+    const size_t len = strlen(str);
+
+    if (json->size - start < len || memcmp(&json->bytes[start], str, len) != 0
+        || !is_delimiter(json, start + len))
+        return start;
+    return start + len;
+}
+
+static int fail(struct jz_json *json, const size_t i, const enum jz_error error)
+{
+    json->error = error;
+    json->error_index = i;
+    return -1;
+}
+
+int jz_json_next_token(struct jz_json *json, struct token *tok)
+{
+    const uint8_t *bytes;
+    size_t start, end, i;
+
+    assert(json && json->index);
+
+    bytes = json->bytes;
+    start = json->index[json->next];
+    end = start + 1;
+
+    tok->start = start;
+    tok->id.str = NULL;
+    tok->id.len = 0;
+
+    if (start == json->size) {
+        tok->type = TOKEN_EOF;
+        tok->end = start;
+        return 0;
+    }
+
+    switch (bytes[start]) {
+    case '{': tok->type = TOKEN_BRACE_LEFT; break;
+    case '}': tok->type = TOKEN_BRACE_RIGHT; break;
+    case '[': tok->type = TOKEN_SQUARE_LEFT; break;
+    case ']': tok->type = TOKEN_SQUARE_RIGHT; break;
+    case ':': tok->type = TOKEN_COLON; break;
+    case ',': tok->type = TOKEN_COMMA; break;
+
+    // The closing quote is the next entry, or missing if only the size is
+    // left
+    case '"':
+        end = json->index[json->next + 1];
+        if (end == json->size)
+            return fail(json, start, JZ_ERROR_INVALID_STRING);
+        if ((i = validate_string(bytes, start + 1, end)) != end)
+            return fail(json, i, JZ_ERROR_INVALID_STRING);
+        tok->type = TOKEN_STRING_LITERAL;
+        json->next++;
+        end++;
+        break;
+
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+        end = scan_number(bytes, start, json->size);
+        if (end == start || !is_delimiter(json, end))
+            return fail(json, start, JZ_ERROR_INVALID_NUMBER);
+        tok->type = TOKEN_NUMERIC_LITERAL;
+        break;
+
+    case 't':
+        end = scan_literal(json, start, "true");
+        tok->type = TOKEN_TRUE;
+        break;
+    case 'f':
+        end = scan_literal(json, start, "false");
+        tok->type = TOKEN_FALSE;
+        break;
+    case 'n':
+        end = scan_literal(json, start, "null");
+        tok->type = TOKEN_NULL;
+        break;
+
+    default:
+        return fail(json, start, JZ_ERROR_INVALID_CHARACTER);
+    }
+
+    if (end == start)
+        return fail(json, start, JZ_ERROR_INVALID_CHARACTER);
+
+    tok->end = end;
+    json->next++;
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef JSON_H_
+#define JSON_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "token.h"
+#include "tokenizer.h"
+
+// Strict JSON lexer. jz_json_init finds every structural character, string
+// quote and start of a number or literal in one pass over the input, 64
+// bytes at a time. jz_json_next_token then walks that index, so whitespace
+// is never looked at again, and only validates the token at each entry.
+//
+// Tokens are the same as for JavaScript: braces, squares, TOKEN_COLON,
+// TOKEN_COMMA, TOKEN_STRING_LITERAL, TOKEN_NUMERIC_LITERAL, TOKEN_TRUE,
+// TOKEN_FALSE and TOKEN_NULL, then TOKEN_EOF. Only the type and the span
+// are set, with strings spanning their quotes. The order of tokens is not
+// checked against the JSON grammar.
+struct jz_json
+{
+    const uint8_t *bytes;
+    size_t size;
+
+    // Offsets found by jz_json_init, ending with size
+    uint32_t *index;
+    size_t next;
+
+    // Why the last failed token failed, and where
+    enum jz_error error;
+    size_t error_index;
+};
+
+// Builds the index of bytes, which need no padding. Fails if it cannot be
+// allocated, or if the input is 4 GiB or more.
+int jz_json_init(struct jz_json *json, const uint8_t *bytes, size_t size);
+void jz_json_free(struct jz_json *json);
+
+int jz_json_next_token(struct jz_json *json, struct token *tok);
+
+#endif // JSON_H_
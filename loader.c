@@ -0,0 +1,586 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef JZ_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "loader.h"
+#include "tokenizer.h"
+
+// Largest single read, as io_uring lengths are 32 bits
+#define LOADER_READ_MAX (1u << 30)
+
+// Allocates a buffer for size bytes followed by zero padding
+static uint8_t *alloc_padded(const size_t size)
+{
+    uint8_t *bytes;
+
+    if (size > SIZE_MAX - JZ_PADDING || !(bytes = malloc(size + JZ_PADDING)))
+        return NULL;
+
+    memset(&bytes[size], 0, JZ_PADDING);
+    return bytes;
+}
+
+static void read_file(struct jz_file *file)
+{
+    struct stat st;
+    size_t done = 0;
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(file->path, O_RDONLY | O_CLOEXEC)) < 0) {
+        file->error = errno;
+        return;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        file->error = errno;
+        goto out;
+    }
+
+    if (!(file->bytes = alloc_padded(st.st_size))) {
+        file->error = ENOMEM;
+        goto out;
+    }
+
+    // A file that shrinks meanwhile is cut short
+    while (done < (size_t)st.st_size) {
+        if ((n = pread(fd, &file->bytes[done], st.st_size - done, done)) < 0) {
+            if (errno == EINTR)
+                continue;
+            file->error = errno;
+            free(file->bytes);
+            file->bytes = NULL;
+            goto out;
+        }
+        if (n == 0)
+            break;
+        done += n;
+    }
+
+    file->size = done;
+    memset(&file->bytes[done], 0, JZ_PADDING);
+
+out:
+    close(fd);
+}
+
+struct pool
+{
+    const char *const *paths;
+    size_t count;
+    _Atomic size_t next;
+
+    jz_file_callback callback;
+    void *data;
+};
+
+static void *pool_reader(void *arg)
+{
+    struct pool *pool = arg;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+        struct jz_file file = { .index = i, .path = pool->paths[i] };
+        read_file(&file);
+        pool->callback(&file, pool->data);
+    }
+
+    return NULL;
+}
+
+// Reads files with pread on the calling thread and threads - 1 others. The
+// callback is called from all of them.
+int jz_load_files_threads(const char *const *paths, size_t count, unsigned threads,
+    jz_file_callback callback, void *data)
+{
+    struct pool pool = {
+        .paths = paths,
+        .count = count,
+        .callback = callback,
+        .data = data,
+    };
+    pthread_t *tids;
+    unsigned n = 0;
+
+    assert((paths || count == 0) && callback);
+
+    if (threads < 1)
+        threads = 1;
+    if (!(tids = malloc(threads * sizeof(*tids))))
+        return -1;
+
+    atomic_init(&pool.next, 0);
+
+    // Fewer threads only make it slower
+    while (n + 1 < threads && pthread_create(&tids[n], NULL, pool_reader, &pool) == 0)
+        n++;
+    pool_reader(&pool);
+
+    while (n > 0)
+        pthread_join(tids[--n], NULL);
+
+    free(tids);
+    return 0;
+}
+
+#ifdef JZ_HAVE_IO_URING
+
+struct ring
+{
+    int fd;
+    unsigned entries;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_queued; // Since the last io_uring_enter
+    unsigned inflight;  // Submitted and not yet completed
+
+    unsigned closing; // Closes in flight
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+};
+
+enum
+{
+    OP_OPEN,
+    OP_STATX,
+    OP_READ,
+    OP_CLOSE,
+};
+
+// One file being loaded
+struct slot
+{
+    struct jz_file file;
+    struct statx stx;
+    int fd;
+    size_t done;
+    unsigned pending; // Operations in flight
+    bool used;
+};
+
+static int ring_enter(struct ring *ring, unsigned wait)
+{
+    const unsigned n = ring->sq_queued;
+    int ret;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, n, wait,
+            wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0)
+        return -1;
+
+    ring->sq_queued -= ret;
+    ring->inflight += ret;
+    return 0;
+}
+
+// Waits for everything submitted to complete, so that the kernel no longer
+// writes to slots or buffers once they are freed. Entries that were queued
+// but not submitted are dropped with the ring, and files opened meanwhile
+// are closed. Returns -1 if waiting fails, in which case nothing the
+// requests point to may be freed.
+static int ring_drain(struct ring *ring)
+{
+    const struct io_uring_cqe *cqe;
+    unsigned head;
+
+    ring->sq_queued = 0;
+
+    while (ring->inflight > 0) {
+        if (ring_enter(ring, 1) < 0)
+            return -1;
+
+        head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            cqe = &ring->cqes[head & *ring->cq_mask];
+            if ((cqe->user_data & 3) == OP_OPEN && cqe->res >= 0)
+                close(cqe->res);
+            ring->inflight--;
+            __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+        }
+    }
+
+    return 0;
+}
+
+static void ring_free(struct ring *ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    if (ring->sq_ptr)
+        munmap(ring->sq_ptr, ring->sq_len);
+    if (ring->fd >= 0)
+        close(ring->fd);
+}
+
+// Whether the kernel supports every operation used here
+static bool ring_probe(const struct ring *ring)
+{
+    static const uint8_t ops[] = {
+        IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE,
+    };
+    const size_t nops = 64;
+    struct io_uring_probe *probe;
+    bool ok = true;
+
+    if (!(probe = calloc(1, sizeof(*probe) + nops * sizeof(probe->ops[0]))))
+        return false;
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, nops) < 0) {
+        free(probe);
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(ops); i++) {
+        if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+            ok = false;
+    }
+
+    free(probe);
+    return ok;
+}
+
+static int ring_init(struct ring *ring, const unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    if ((ring->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0)
+        return -1;
+    ring->entries = params.sq_entries;
+
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len)
+            ring->sq_len = ring->cq_len;
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        goto fail;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            goto fail;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    ring->sq_head = (unsigned *)((uint8_t *)ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned *)((uint8_t *)ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)((uint8_t *)ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((uint8_t *)ring->sq_ptr + params.sq_off.array);
+    ring->cq_head = (unsigned *)((uint8_t *)ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned *)((uint8_t *)ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)((uint8_t *)ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((uint8_t *)ring->cq_ptr + params.cq_off.cqes);
+
+    if (!ring_probe(ring))
+        goto fail;
+
+    return 0;
+
+fail:
+    ring_free(ring);
+    return -1;
+}
+
+// Returns a cleared submission entry for op on slot i, submitting what is
+// queued first if the ring is full
+static struct io_uring_sqe *ring_sqe(struct ring *ring, const int op, const size_t i)
+{
+    const unsigned tail = *ring->sq_tail;
+    struct io_uring_sqe *sqe;
+
+    while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->entries) {
+        if (ring_enter(ring, 0) < 0)
+            return NULL;
+    }
+
+    sqe = &ring->sqes[tail & *ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op == OP_OPEN ? IORING_OP_OPENAT
+        : op == OP_STATX ? IORING_OP_STATX
+        : op == OP_READ ? IORING_OP_READ
+        : IORING_OP_CLOSE;
+    sqe->user_data = (uint64_t)i << 2 | op;
+
+    ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->sq_queued++;
+
+    return sqe;
+}
+
+static int queue_read(struct ring *ring, struct slot *slot, const size_t i)
+{
+    const size_t left = slot->file.size - slot->done;
+    struct io_uring_sqe *sqe;
+
+    if (!(sqe = ring_sqe(ring, OP_READ, i)))
+        return -1;
+
+    sqe->fd = slot->fd;
+    sqe->addr = (uintptr_t)&slot->file.bytes[slot->done];
+    sqe->len = left < LOADER_READ_MAX ? left : LOADER_READ_MAX;
+    sqe->off = slot->done;
+    slot->pending++;
+    return 0;
+}
+
+// Hands a finished file to the callback, and closes it in the background
+static int finish(struct ring *ring, struct slot *slot, const size_t i,
+    jz_file_callback callback, void *data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (slot->file.error) {
+        free(slot->file.bytes);
+        slot->file.bytes = NULL;
+        slot->file.size = 0;
+    } else {
+        slot->file.size = slot->done;
+        memset(&slot->file.bytes[slot->done], 0, JZ_PADDING);
+    }
+
+    if (slot->fd >= 0) {
+        if (!(sqe = ring_sqe(ring, OP_CLOSE, i)))
+            return -1;
+        sqe->fd = slot->fd;
+        slot->fd = -1;
+        ring->closing++;
+    }
+
+    callback(&slot->file, data);
+    slot->used = false;
+    return 0;
+}
+
+// Handles one completion. Returns 1 if the slot became free.
+static int complete(struct ring *ring, struct slot *slots, const struct io_uring_cqe *cqe,
+    jz_file_callback callback, void *data)
+{
+    const size_t i = cqe->user_data >> 2;
+    struct slot *slot = &slots[i];
+
+    if ((cqe->user_data & 3) == OP_CLOSE) {
+        ring->closing--;
+        return 0;
+    }
+
+    slot->pending--;
+    if (cqe->res < 0 && !slot->file.error)
+        slot->file.error = -cqe->res;
+
+    switch (cqe->user_data & 3) {
+    case OP_OPEN:
+        if (cqe->res >= 0)
+            slot->fd = cqe->res;
+        // fallthrough
+    case OP_STATX:
+        if (slot->pending > 0)
+            return 0;
+        if (!slot->file.error) {
+            slot->file.size = slot->stx.stx_size;
+            if (slot->file.size != slot->stx.stx_size
+                || !(slot->file.bytes = alloc_padded(slot->file.size)))
+                slot->file.error = ENOMEM;
+        }
+        if (!slot->file.error && slot->file.size > 0)
+            return queue_read(ring, slot, i);
+        break;
+
+    case OP_READ:
+        if (cqe->res > 0) {
+            slot->done += cqe->res;
+            if (slot->done < slot->file.size)
+                return queue_read(ring, slot, i);
+        }
+        break;
+    }
+
+    if (finish(ring, slot, i, callback, data) < 0)
+        return -1;
+    return 1;
+}
+
+// Reads files through io_uring with up to depth of them in flight. Opening,
+// statx and reading are submitted in batches, and the callback is called on
+// the calling thread. Fails with ENOSYS if io_uring or any of the operations
+// is not available.
+int jz_load_files_uring(const char *const *paths, size_t count, unsigned depth,
+    jz_file_callback callback, void *data)
+{
+    struct slot *slots;
+    struct ring ring;
+    size_t next = 0, active = 0;
+    unsigned head;
+    int ret = -1;
+
+    assert((paths || count == 0) && callback);
+
+    if (depth < 1)
+        depth = 1;
+    if (depth > 4096)
+        depth = 4096;
+
+    // Each file has at most two operations and a close in flight
+    if (ring_init(&ring, depth * 3) < 0) {
+        errno = ENOSYS;
+        return -1;
+    }
+    if (!(slots = calloc(depth, sizeof(*slots)))) {
+        ring_free(&ring);
+        return -1;
+    }
+
+    while (next < count || active > 0 || ring.closing > 0) {
+        for (size_t i = 0; i < depth && next < count; i++) {
+            struct slot *slot = &slots[i];
+            struct io_uring_sqe *sqe;
+
+            if (slot->used)
+                continue;
+
+            memset(slot, 0, sizeof(*slot));
+            slot->used = true;
+            slot->fd = -1;
+            slot->file.index = next;
+            slot->file.path = paths[next++];
+            active++;
+
+            if (!(sqe = ring_sqe(&ring, OP_OPEN, i)))
+                goto out;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)slot->file.path;
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            slot->pending++;
+
+            // Needs only the path, so it runs alongside the open
+            if (!(sqe = ring_sqe(&ring, OP_STATX, i)))
+                goto out;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)slot->file.path;
+            sqe->len = STATX_SIZE;
+            sqe->off = (uintptr_t)&slot->stx;
+            slot->pending++;
+        }
+
+        if (ring_enter(&ring, 1) < 0)
+            goto out;
+
+        head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            const int status = complete(&ring, slots,
+                &ring.cqes[head & *ring.cq_mask], callback, data);
+            ring.inflight--;
+            __atomic_store_n(ring.cq_head, ++head, __ATOMIC_RELEASE);
+
+            if (status < 0)
+                goto out;
+            active -= status;
+        }
+    }
+
+    ret = 0;
+
+out:
+    // On failure, files still in flight are dropped. If their requests
+    // cannot be waited for, their memory is leaked rather than freed under
+    // the kernel.
+    if (ret < 0 && ring_drain(&ring) < 0) {
+        ring_free(&ring);
+        return ret;
+    }
+
+    for (size_t i = 0; ret < 0 && i < depth; i++) {
+        if (!slots[i].used)
+            continue;
+        free(slots[i].file.bytes);
+        if (slots[i].fd >= 0)
+            close(slots[i].fd);
+    }
+    free(slots);
+    ring_free(&ring);
+    return ret;
+}
+
+#else
+
+int jz_load_files_uring(const char *const *paths, size_t count, unsigned depth,
+    jz_file_callback callback, void *data)
+{
+    (void)paths;
+    (void)count;
+    (void)depth;
+    (void)callback;
+    (void)data;
+
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
+
+// Reads files with io_uring if available, and otherwise with a pool of depth
+// threads
+int jz_load_files(const char *const *paths, size_t count, unsigned depth,
+    jz_file_callback callback, void *data)
+{
+    if (jz_load_files_uring(paths, count, depth, callback, data) == 0)
+        return 0;
+    if (errno != ENOSYS)
+        return -1;
+
+    return jz_load_files_threads(paths, count, depth, callback, data);
+}
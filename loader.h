@@ -0,0 +1,33 @@
+#ifndef LOADER_H_
+#define LOADER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A file read by jz_load_files. The bytes are followed by JZ_PADDING zero
+// bytes, so they can be tokenized in place with the JZ_FEATURE_SENTINEL
+// entry points.
+struct jz_file
+{
+    size_t index; // Of the path in the list given
+    const char *path;
+
+    // Owned by the callback and released with free, NULL on error
+    uint8_t *bytes;
+    size_t size;
+
+    int error; // errno value if the file could not be read
+};
+
+// Called once for every file as soon as it has been read, while reads of
+// other files may still be in flight
+typedef void (*jz_file_callback)(const struct jz_file *file, void *data);
+
+int jz_load_files(const char *const *paths, size_t count, unsigned depth,
+    jz_file_callback callback, void *data);
+int jz_load_files_uring(const char *const *paths, size_t count, unsigned depth,
+    jz_file_callback callback, void *data);
+int jz_load_files_threads(const char *const *paths, size_t count, unsigned threads,
+    jz_file_callback callback, void *data);
+
+#endif // LOADER_H_
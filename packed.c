@@ -0,0 +1,167 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "packed.h"
+#include "vec.h"
+
+_Static_assert(sizeof(struct jz_packed_token) == 8, "packed tokens are 8 bytes");
+_Static_assert(TOKEN_COUNT <= UINT8_MAX + 1, "token types fit in a byte");
+
+enum {
+    ERROR_COUNT = 0
+#define F(x, s) + 1
+    JZ_ERROR_LIST(F)
+#undef F
+};
+
+_Static_assert(ERROR_COUNT <= (UINT8_MAX >> JZ_PACKED_ERROR_SHIFT) + 1,
+    "error reasons fit in the flags");
+
+void jz_packed_init(struct jz_packed_tokens *p)
+{
+    assert(p);
+
+    p->tokens = NULL;
+    p->long_tokens = NULL;
+}
+
+void jz_packed_free(struct jz_packed_tokens *p)
+{
+    assert(p);
+
+    vec_free(p->tokens);
+    p->tokens = NULL;
+    vec_free(p->long_tokens);
+    p->long_tokens = NULL;
+}
+
+// Appends tok. Fails if it cannot be stored, or if it starts at 4 GiB or
+// more into the input.
+int jz_pack_token(struct jz_packed_tokens *p, const struct token *tok)
+{
+    const size_t len = tok->end - tok->start;
+    struct jz_packed_token packed = {
+        .type = tok->type,
+        .flags = (tok->newline_before ? JZ_PACKED_NEWLINE_BEFORE : 0)
+            | (tok->type == TOKEN_ERROR ? tok->error << JZ_PACKED_ERROR_SHIFT : 0),
+        .len = len < JZ_PACKED_LEN_MAX ? len : JZ_PACKED_LEN_MAX,
+        .start = tok->start,
+    };
+
+    assert(p && tok);
+
+    if (tok->start > UINT32_MAX)
+        return -1;
+
+    if (len >= JZ_PACKED_LEN_MAX) {
+        packed.flags |= JZ_PACKED_LONG;
+        if (!vec_push(p->long_tokens, ((struct jz_packed_length){
+                .index = vec_len(p->tokens),
+                .len = len })))
+            return -1;
+    }
+
+    if (!vec_push(p->tokens, packed)) {
+        if (len >= JZ_PACKED_LEN_MAX)
+            vec_resize(p->long_tokens, vec_len(p->long_tokens) - 1);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Tokenizes the rest of ctx with next into p, up to and including
+// TOKEN_EOF. Identifier payloads are freed as they are packed.
+int jz_pack_tokens(struct jz_packed_tokens *p, struct context *ctx,
+    int (*next)(struct context *ctx, struct token *tok))
+{
+    struct token tok;
+    int retval;
+
+    assert(p && ctx && next);
+
+    do {
+        if (next(ctx, &tok) < 0)
+            return -1;
+        retval = jz_pack_token(p, &tok);
+        vec_free(tok.id.str);
+        if (retval < 0)
+            return -1;
+    } while (tok.type != TOKEN_EOF);
+
+    return 0;
+}
+
+static size_t long_length(const struct jz_packed_tokens *p, const size_t index)
+{
+    size_t lo = 0, hi = vec_len(p->long_tokens);
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (p->long_tokens[mid].index < index)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    assert(lo < vec_len(p->long_tokens) && p->long_tokens[lo].index == index);
+    return p->long_tokens[lo].len;
+}
+
+// Sets the type, span, newline_before and error of tok from the token at
+// index. Other fields are left untouched, except that there is no payload.
+void jz_unpack_token(const struct jz_packed_tokens *p, size_t index, struct token *tok)
+{
+    const struct jz_packed_token *packed;
+
+    assert(p && tok && index < vec_len(p->tokens));
+
+    packed = &p->tokens[index];
+    tok->type = packed->type;
+    tok->start = packed->start;
+    tok->end = packed->start + (packed->flags & JZ_PACKED_LONG
+        ? long_length(p, index) : packed->len);
+    tok->newline_before = packed->flags & JZ_PACKED_NEWLINE_BEFORE;
+    tok->error = packed->flags >> JZ_PACKED_ERROR_SHIFT;
+    tok->id.str = NULL;
+    tok->id.len = 0;
+}
+
+// Decodes the payload of an unpacked identifier again from its source, which
+// ctx was set up for when tokenizing
+int jz_unpack_payload(const struct context *ctx, struct token *tok)
+{
+    const size_t len = tok->end - tok->start;
+    struct context source;
+    struct token t;
+    int retval;
+
+    assert(ctx && tok && tok->type == TOKEN_IDENTIFIER);
+
+    switch (ctx->encoding) {
+    case JZ_ENCODING_UTF8:
+        jz_context_init(&source, &ctx->bytes[tok->start], len);
+        retval = jz_next_token_payload(&source, &t);
+        break;
+    case JZ_ENCODING_LATIN1:
+        jz_context_init_latin1(&source, &ctx->bytes[tok->start], len);
+        retval = jz_next_token_latin1(&source, &t);
+        break;
+    case JZ_ENCODING_UTF16:
+        jz_context_init_utf16(&source, &ctx->units[tok->start], len);
+        retval = jz_next_token_utf16(&source, &t);
+        break;
+    default:
+        retval = -1;
+        break;
+    }
+
+    if (retval < 0)
+        return -1;
+
+    tok->id.str = t.id.str;
+    tok->id.len = t.id.len;
+    return 0;
+}
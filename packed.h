@@ -0,0 +1,54 @@
+#ifndef PACKED_H_
+#define PACKED_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "token.h"
+#include "tokenizer.h"
+
+#define JZ_PACKED_NEWLINE_BEFORE (1u << 0) // Same as tok->newline_before
+#define JZ_PACKED_LONG           (1u << 1) // Length is in the side table
+
+// The rest of the flags hold tok->error, the reason for a TOKEN_ERROR
+#define JZ_PACKED_ERROR_SHIFT 2
+
+// Lengths from this one up are kept in the side table
+#define JZ_PACKED_LEN_MAX UINT16_MAX
+
+// A token in 8 bytes instead of a struct token with its own payload. Only
+// the type, the span, whether a line terminator comes before it and the
+// error reason are kept, with offsets in code units as for struct token.
+struct jz_packed_token
+{
+    uint8_t type;
+    uint8_t flags;
+    uint16_t len;
+    uint32_t start;
+};
+
+// Length of a token too long for its len field, by its index
+struct jz_packed_length
+{
+    size_t index;
+    size_t len;
+};
+
+struct jz_packed_tokens
+{
+    // Vectors, with long_tokens in order of index
+    struct jz_packed_token *tokens;
+    struct jz_packed_length *long_tokens;
+};
+
+void jz_packed_init(struct jz_packed_tokens *p);
+void jz_packed_free(struct jz_packed_tokens *p);
+
+int jz_pack_token(struct jz_packed_tokens *p, const struct token *tok);
+int jz_pack_tokens(struct jz_packed_tokens *p, struct context *ctx,
+    int (*next)(struct context *ctx, struct token *tok));
+
+void jz_unpack_token(const struct jz_packed_tokens *p, size_t index, struct token *tok);
+int jz_unpack_payload(const struct context *ctx, struct token *tok);
+
+#endif // PACKED_H_
@@ -0,0 +1,192 @@
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "token.h"
+#include "tokenizer.h"
+#include "vec.h"
+
+// Busy-waits for a while before giving up the core, as the other side is
+// usually only a few tokens behind
+static void pipeline_wait(unsigned *spins)
+{
+    if (++*spins < 256) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        return;
+    }
+
+    sched_yield();
+}
+
+// Room for at least nbatches batches, rounded up to a power of two
+int jz_pipeline_init(struct jz_pipeline *p, size_t nbatches)
+{
+    size_t n = 2;
+
+    assert(p && nbatches > 0);
+
+    while (n < nbatches) {
+        if (n > SIZE_MAX / 2 / sizeof(struct jz_batch))
+            return -1;
+        n *= 2;
+    }
+
+    memset(p, 0, sizeof(*p));
+    if (!(p->slots = aligned_alloc(JZ_CACHE_LINE, n * sizeof(struct jz_batch))))
+        return -1;
+
+    p->mask = n - 1;
+    atomic_init(&p->head, 0);
+    atomic_init(&p->tail, 0);
+    atomic_init(&p->closed, false);
+    return 0;
+}
+
+// Payloads of tokens that were never popped are freed as well
+void jz_pipeline_free(struct jz_pipeline *p)
+{
+    size_t head, tail;
+
+    assert(p);
+
+    head = atomic_load_explicit(&p->head, memory_order_acquire) + p->popped;
+    tail = atomic_load_explicit(&p->tail, memory_order_acquire);
+
+    for (; head != tail; head++) {
+        struct jz_batch *batch = &p->slots[head & p->mask];
+        for (size_t i = 0; i < batch->count; i++)
+            vec_free(batch->tokens[i].id.str);
+    }
+
+    // Tokens pushed but never flushed
+    for (size_t i = 0; i < p->fill; i++)
+        vec_free(p->slots[tail & p->mask].tokens[i].id.str);
+
+    free(p->slots);
+    p->slots = NULL;
+}
+
+// Makes the batch at tail visible to the consumer
+static void publish(struct jz_pipeline *p)
+{
+    const size_t tail = atomic_load_explicit(&p->tail, memory_order_relaxed);
+
+    p->slots[tail & p->mask].count = p->fill;
+    p->fill = 0;
+    atomic_store_explicit(&p->tail, tail + 1, memory_order_release);
+}
+
+// Adds tok to the current batch, waiting for the consumer if the ring is
+// full. The batch is handed over once it is full or on jz_pipeline_flush.
+void jz_pipeline_push(struct jz_pipeline *p, const struct token *tok)
+{
+    const size_t tail = atomic_load_explicit(&p->tail, memory_order_relaxed);
+    unsigned spins = 0;
+
+    if (p->fill == 0) {
+        while (tail - p->head_cache > p->mask) {
+            p->head_cache = atomic_load_explicit(&p->head, memory_order_acquire);
+            if (tail - p->head_cache > p->mask)
+                pipeline_wait(&spins);
+        }
+    }
+
+    p->slots[tail & p->mask].tokens[p->fill++] = *tok;
+    if (p->fill == JZ_PIPELINE_BATCH)
+        publish(p);
+}
+
+void jz_pipeline_flush(struct jz_pipeline *p)
+{
+    if (p->fill > 0)
+        publish(p);
+}
+
+// Flushes, and tells the consumer that nothing more will be pushed
+void jz_pipeline_close(struct jz_pipeline *p)
+{
+    jz_pipeline_flush(p);
+    atomic_store_explicit(&p->closed, true, memory_order_release);
+}
+
+// Pushes every token from next until TOKEN_EOF, then closes the pipeline. If
+// next fails, the pipeline is closed without a TOKEN_EOF and -1 is returned.
+int jz_pipeline_tokenize(struct jz_pipeline *p, struct context *ctx,
+    int (*next)(struct context *ctx, struct token *tok))
+{
+    struct token tok;
+
+    assert(p && ctx && next);
+
+    do {
+        if (next(ctx, &tok) < 0) {
+            jz_pipeline_close(p);
+            return -1;
+        }
+        jz_pipeline_push(p, &tok);
+    } while (tok.type != TOKEN_EOF);
+
+    jz_pipeline_close(p);
+    return 0;
+}
+
+// Returns the next batch, or NULL if there is none yet. Batches stay valid
+// until they are given back with jz_pipeline_release, oldest first.
+const struct jz_batch *jz_pipeline_try_pop(struct jz_pipeline *p)
+{
+    const size_t next = atomic_load_explicit(&p->head, memory_order_relaxed) + p->popped;
+
+    if (next == p->tail_cache) {
+        p->tail_cache = atomic_load_explicit(&p->tail, memory_order_acquire);
+        if (next == p->tail_cache)
+            return NULL;
+    }
+
+    p->popped++;
+    return &p->slots[next & p->mask];
+}
+
+// Like jz_pipeline_try_pop, but waits for a batch. Returns NULL once the
+// pipeline is closed and everything in it has been popped.
+const struct jz_batch *jz_pipeline_pop(struct jz_pipeline *p)
+{
+    const struct jz_batch *batch;
+    unsigned spins = 0;
+
+    while (!(batch = jz_pipeline_try_pop(p))) {
+        if (jz_pipeline_done(p))
+            return NULL;
+        pipeline_wait(&spins);
+    }
+
+    return batch;
+}
+
+// Gives the oldest popped batch back to the producer. The payloads of its
+// tokens belong to the consumer.
+void jz_pipeline_release(struct jz_pipeline *p)
+{
+    const size_t head = atomic_load_explicit(&p->head, memory_order_relaxed);
+
+    assert(p->popped > 0);
+
+    p->popped--;
+    atomic_store_explicit(&p->head, head + 1, memory_order_release);
+}
+
+// Whether the pipeline is closed and every batch has been popped
+bool jz_pipeline_done(struct jz_pipeline *p)
+{
+    const size_t next = atomic_load_explicit(&p->head, memory_order_relaxed) + p->popped;
+
+    // The tail is read after closed, so it is final
+    if (!atomic_load_explicit(&p->closed, memory_order_acquire))
+        return false;
+
+    p->tail_cache = atomic_load_explicit(&p->tail, memory_order_acquire);
+    return next == p->tail_cache;
+}
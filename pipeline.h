@@ -0,0 +1,64 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "token.h"
+#include "tokenizer.h"
+
+#define JZ_CACHE_LINE 64
+
+// Tokens handed over at a time. A token is larger than a cache line, so a
+// batch spans several whole lines instead.
+#define JZ_PIPELINE_BATCH 16
+
+struct jz_batch
+{
+    _Alignas(JZ_CACHE_LINE) size_t count;
+    struct token tokens[JZ_PIPELINE_BATCH];
+};
+
+// Bounded ring of batches from one producer thread to one consumer thread.
+// The producer waits while the ring is full, and the consumer while it is
+// empty. Identifier payloads move to the consumer along with their tokens.
+struct jz_pipeline
+{
+    struct jz_batch *slots;
+    size_t mask;
+
+    // Next batch to be read, written by the consumer
+    _Alignas(JZ_CACHE_LINE) _Atomic size_t head;
+
+    // Only used by the consumer, so the producer polling head does not see
+    // these change
+    _Alignas(JZ_CACHE_LINE) size_t tail_cache;
+    size_t popped;
+
+    // Next batch to be written, written by the producer
+    _Alignas(JZ_CACHE_LINE) _Atomic size_t tail;
+    _Atomic bool closed;
+
+    // Only used by the producer, and written on every push
+    _Alignas(JZ_CACHE_LINE) size_t head_cache;
+    size_t fill; // Tokens in the batch at tail
+};
+
+int jz_pipeline_init(struct jz_pipeline *p, size_t nbatches);
+void jz_pipeline_free(struct jz_pipeline *p);
+
+// Producer side
+void jz_pipeline_push(struct jz_pipeline *p, const struct token *tok);
+void jz_pipeline_flush(struct jz_pipeline *p);
+void jz_pipeline_close(struct jz_pipeline *p);
+int jz_pipeline_tokenize(struct jz_pipeline *p, struct context *ctx,
+    int (*next)(struct context *ctx, struct token *tok));
+
+// Consumer side
+const struct jz_batch *jz_pipeline_pop(struct jz_pipeline *p);
+const struct jz_batch *jz_pipeline_try_pop(struct jz_pipeline *p);
+void jz_pipeline_release(struct jz_pipeline *p);
+bool jz_pipeline_done(struct jz_pipeline *p);
+
+#endif // PIPELINE_H_
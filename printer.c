@@ -0,0 +1,309 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "printer.h"
+#include "token.h"
+#include "tokenizer.h"
+
+static const char *token_names[] = {
+#define F(x, s) #x,
+    TOKEN_LIST(F)
+#undef F
+};
+
+static const uint8_t token_name_lengths[] = {
+#define F(x, s) sizeof(#x) - 1,
+    TOKEN_LIST(F)
+#undef F
+};
+
+static const char *token_texts[] = {
+#define F(x, s) s,
+    TOKEN_LIST(F)
+#undef F
+};
+
+static const uint8_t token_text_lengths[] = {
+#define F(x, s) sizeof(s) - 1,
+    TOKEN_LIST(F)
+#undef F
+};
+
+static int write_all(int fd, const uint8_t *bytes, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, bytes, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        bytes += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int jz_writer_flush(struct jz_writer *w)
+{
+    assert(w);
+
+    if (w->fd < 0)
+        return 0;
+
+    if (write_all(w->fd, w->buf, w->len) < 0)
+        return -1;
+    w->len = 0;
+    return 0;
+}
+
+int jz_write(struct jz_writer *w, const void *bytes, size_t len)
+{
+    assert(w);
+
+    if (w->len + len <= w->cap) {
+        memcpy(&w->buf[w->len], bytes, len);
+        w->len += len;
+        return 0;
+    }
+
+    if (w->fd < 0 || jz_writer_flush(w) < 0)
+        return -1;
+
+    // Too large to be worth buffering
+    if (len > w->cap)
+        return write_all(w->fd, bytes, len);
+
+    memcpy(w->buf, bytes, len);
+    w->len = len;
+    return 0;
+}
+
+static int write_byte(struct jz_writer *w, const uint8_t c)
+{
+    if (w->len < w->cap) {
+        w->buf[w->len++] = c;
+        return 0;
+    }
+
+    return jz_write(w, &c, 1);
+}
+
+// Text written for tok, from w->source if it has no fixed text or payload.
+// Returns -1 if it has to come from there and there is none.
+static int token_text(const struct jz_writer *w, const struct token *tok,
+    const uint8_t **str, size_t *len)
+{
+    if (token_text_lengths[tok->type] > 0) {
+        *str = (const uint8_t *)token_texts[tok->type];
+        *len = token_text_lengths[tok->type];
+        return 0;
+    }
+
+    if (tok->type == TOKEN_IDENTIFIER && tok->id.str) {
+        *str = tok->id.str;
+        *len = tok->id.len;
+
+        // Identifier payloads are null-terminated
+        if (*len > 0 && (*str)[*len - 1] == '\0')
+            (*len)--;
+        return 0;
+    }
+
+    if (!w->source)
+        return -1;
+
+    *str = &w->source[tok->start];
+    *len = tok->end - tok->start;
+    return 0;
+}
+
+static bool is_word_token(const int type)
+{
+    const char *s = token_texts[type];
+    return s[0] == '\0' || (s[0] >= 'a' && s[0] <= 'z');
+}
+
+// Whether two adjacent punctuators need a space between them to be read back
+// as the same tokens, e.g. + followed by ++
+static bool punctuators_need_space(const int prev, const int next)
+{
+    const size_t prev_len = token_text_lengths[prev];
+    const size_t next_len = token_text_lengths[next];
+    uint8_t buf[8];
+    struct context ctx;
+    struct token tok;
+
+    // Would start a comment
+    if (token_texts[prev][prev_len - 1] == '/'
+        && (token_texts[next][0] == '/' || token_texts[next][0] == '*'))
+        return true;
+
+    // Two dots are not a token, but three are
+    if (prev == TOKEN_DOT && token_texts[next][0] == '.')
+        return true;
+
+    memcpy(buf, token_texts[prev], prev_len);
+    memcpy(&buf[prev_len], token_texts[next], next_len);
+    jz_context_init(&ctx, buf, prev_len + next_len);
+
+    return jz_next_token_span(&ctx, &tok) < 0
+        || tok.type != prev
+        || ctx.index != prev_len;
+}
+
+#define SPACE_WORDS ((TOKEN_COUNT + 63) / 64)
+
+// Bit next of row prev is set if a token of type next written right after
+// one of type prev needs a space in between. Filled in once, by the first
+// jz_writer_init.
+static uint64_t space_table[TOKEN_COUNT][SPACE_WORDS];
+static pthread_once_t space_table_once = PTHREAD_ONCE_INIT;
+
+static void init_space_table(void)
+{
+    for (int prev = 0; prev < TOKEN_COUNT; prev++) {
+        for (int next = 0; next < TOKEN_COUNT; next++) {
+            bool space = is_word_token(prev) && is_word_token(next);
+            if (!space && !is_word_token(prev) && !is_word_token(next))
+                space = punctuators_need_space(prev, next);
+
+            // A . after digits would be read as a decimal point
+            if ((prev == TOKEN_NUMERIC_LITERAL || prev == TOKEN_BIGINT_LITERAL)
+                && token_texts[next][0] == '.')
+                space = true;
+
+            // Scripts read <!-- anywhere and --> at the start of a line as
+            // HTML-like comments, so neither is ever written
+            if ((prev == TOKEN_LESS && next == TOKEN_EXCLAMATION)
+                || (prev == TOKEN_MINUS_MINUS && token_texts[next][0] == '>'))
+                space = true;
+
+            space_table[prev][next / 64] |= (uint64_t)space << (next % 64);
+        }
+    }
+}
+
+static bool needs_space(const int prev, const int next)
+{
+    return space_table[prev][next / 64] >> (next % 64) & 1;
+}
+
+void jz_writer_init(struct jz_writer *w, uint8_t *buf, size_t cap, int fd,
+    enum jz_format format)
+{
+    assert(w && buf && cap > 0);
+
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->fd = fd;
+    w->format = format;
+    w->prev_type = -1;
+    w->source = NULL;
+
+    pthread_once(&space_table_once, init_space_table);
+}
+
+// Whether a line break after a token of this type can matter. Automatic
+// semicolon insertion and restricted productions such as return only look at
+// line breaks after something that may end a statement, and a break is also
+// the only separator that keeps those apart, e.g. a and b in a\nb.
+static bool keeps_line_break(const int type)
+{
+    switch (type) {
+    case TOKEN_PAREN_RIGHT:
+    case TOKEN_SQUARE_RIGHT:
+    case TOKEN_BRACE_RIGHT:
+    case TOKEN_PLUS_PLUS:
+    case TOKEN_MINUS_MINUS:
+        return true;
+
+    default:
+        return is_word_token(type);
+    }
+}
+
+static int write_compact(struct jz_writer *w, const struct token *tok)
+{
+    const int prev = w->prev_type;
+    const uint8_t *str;
+    size_t len;
+
+    if (tok->type == TOKEN_EOF)
+        return 0;
+
+    if (prev >= 0 && tok->newline_before && keeps_line_break(prev)) {
+        if (write_byte(w, '\n') < 0)
+            return -1;
+    } else if (prev >= 0 && needs_space(prev, tok->type)) {
+        if (write_byte(w, ' ') < 0)
+            return -1;
+    }
+
+    if (token_text(w, tok, &str, &len) < 0 || jz_write(w, str, len) < 0)
+        return -1;
+
+    // Numbers are still read as errors, but are spaced as numbers
+    w->prev_type = tok->type == TOKEN_ERROR && tok->error == JZ_ERROR_NUMERIC_LITERAL
+        ? TOKEN_NUMERIC_LITERAL : tok->type;
+    return 0;
+}
+
+static int write_debug(struct jz_writer *w, const struct token *tok)
+{
+    const uint8_t *str;
+    size_t len;
+
+    if (jz_write(w, token_names[tok->type], token_name_lengths[tok->type]) < 0)
+        return -1;
+
+    if (tok->type == TOKEN_IDENTIFIER && token_text(w, tok, &str, &len) == 0) {
+        if (write_byte(w, ' ') < 0 || jz_write(w, str, len) < 0)
+            return -1;
+    }
+
+    if (tok->type == TOKEN_ERROR) {
+        str = (const uint8_t *)jz_error_string(tok->error);
+        if (write_byte(w, ' ') < 0 || jz_write(w, str, strlen((const char *)str)) < 0)
+            return -1;
+    }
+
+    return write_byte(w, '\n');
+}
+
+int jz_write_token(struct jz_writer *w, const struct token *tok)
+{
+    assert(w && tok && tok->type >= 0 && tok->type < TOKEN_COUNT);
+
+    switch (w->format) {
+    case JZ_FORMAT_COMPACT:
+        return write_compact(w, tok);
+
+    case JZ_FORMAT_DEBUG:
+        return write_debug(w, tok);
+    }
+
+    return -1;
+}
+
+void print_token(struct token *tok)
+{
+    struct jz_writer w;
+    uint8_t buf[256];
+
+    // Keep ordering with anything already buffered by stdio
+    fflush(stdout);
+
+    jz_writer_init(&w, buf, sizeof(buf), STDOUT_FILENO, JZ_FORMAT_DEBUG);
+    jz_write_token(&w, tok);
+    jz_writer_flush(&w);
+}
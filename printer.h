@@ -0,0 +1,49 @@
+#ifndef PRINTER_H_
+#define PRINTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "token.h"
+
+enum jz_format
+{
+    JZ_FORMAT_COMPACT, // Source text with minimal whitespace between tokens,
+                       // see jz_write_token
+    JZ_FORMAT_DEBUG,   // One token per line, type name followed by payload
+};
+
+// Buffered output for tokens. Bytes are collected into buf and written to
+// fd when it fills up or on jz_writer_flush. With fd set to -1, output only
+// goes into buf, and writes that do not fit fail.
+struct jz_writer
+{
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    int fd;
+
+    enum jz_format format;
+    int prev_type;
+
+    // Input the tokens were read from, for those written as their source
+    // text, see jz_write_token
+    const uint8_t *source;
+};
+
+void jz_writer_init(struct jz_writer *w, uint8_t *buf, size_t cap, int fd,
+    enum jz_format format);
+int jz_writer_flush(struct jz_writer *w);
+
+int jz_write(struct jz_writer *w, const void *bytes, size_t len);
+// In JZ_FORMAT_COMPACT, a token with newline_before is written on a new line
+// wherever the line break may change how the source is read, e.g. after
+// return or between two statements. Tokens should come from an entry point
+// with JZ_FEATURE_TRIVIA for that.
+//
+// Tokens without fixed text or a payload, such as TOKEN_ERROR for a string
+// literal, are written as the bytes of their span in source. Writing one
+// fails if source is NULL.
+int jz_write_token(struct jz_writer *w, const struct token *tok);
+
+#endif // PRINTER_H_
@@ -0,0 +1,42 @@
+#ifdef JZ_INSTRUMENT
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "token.h"
+#include "tokenizer.h"
+
+static const char *token_names[] = {
+#define F(x, s) #x,
+    TOKEN_LIST(F)
+#undef F
+};
+
+// Writes the counters of ctx to fp as a single JSON object. Token types that
+// were never seen are left out.
+void jz_stats_dump(const struct context *ctx, FILE *fp)
+{
+    const struct jz_stats *stats;
+    const char *sep = "";
+
+    assert(ctx && fp);
+    stats = &ctx->stats;
+
+    fprintf(fp, "{\"tokens\":{");
+    for (int i = 0; i < TOKEN_COUNT; i++) {
+        if (stats->tokens[i] == 0)
+            continue;
+        fprintf(fp, "%s\"%s\":%zu", sep, token_names[i], stats->tokens[i]);
+        sep = ",";
+    }
+
+    fprintf(fp, "},\"bytes\":{\"trivia\":%zu,\"identifier\":%zu,\"punctuator\":%zu}",
+        stats->bytes_trivia, stats->bytes_identifier, stats->bytes_punctuator);
+
+    fprintf(fp, ",\"codepoints\":%zu,\"escapes\":%zu,\"allocations\":%zu"
+        ",\"icu_calls\":%zu,\"slow_paths\":%zu}\n",
+        stats->codepoints, stats->escapes, stats->allocations,
+        stats->icu_calls, stats->slow_paths);
+}
+
+#endif // JZ_INSTRUMENT
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <arena.h>
+#include <vec.h>
+
+#include "test.h"
+
+TEST(arena_alloc)
+{
+    struct jz_arena a;
+    uint8_t *p, *q;
+
+    jz_arena_init(&a);
+    ASSERT_EQ(a.allocations, 0);
+
+    p = jz_arena_alloc(&a, 3);
+    q = jz_arena_alloc(&a, 8);
+    ASSERT_EQ((uintptr_t)q % _Alignof(max_align_t), 0);
+    ASSERT_GE(q - p, 3);
+    ASSERT_EQ(a.allocations, 1);
+
+    // Larger than a chunk
+    memset(jz_arena_alloc(&a, 3 * JZ_ARENA_CHUNK), 0xaa, 3 * JZ_ARENA_CHUNK);
+    ASSERT_EQ(a.allocations, 2);
+
+    // Both chunks are merged into one, which then fits the same work
+    jz_arena_reset(&a);
+    ASSERT_EQ(a.allocations, 3);
+    jz_arena_alloc(&a, 3);
+    jz_arena_alloc(&a, 8);
+    jz_arena_alloc(&a, 3 * JZ_ARENA_CHUNK);
+    jz_arena_reset(&a);
+    ASSERT_EQ(a.allocations, 3);
+
+    jz_arena_free(&a);
+}
+
+TEST(arena_vec)
+{
+    struct jz_arena a;
+    vec_inline(int, 4) scratch;
+    int *v = NULL, *w = NULL;
+
+    jz_arena_init(&a);
+
+    // The last allocation grows in place
+    vec_new(v, &a.allocator, 1);
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(*vec_push(v, i), i);
+    ASSERT_EQ(a.allocations, 1);
+
+    vec_init_inline_from(w, &a.allocator, scratch);
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(*vec_push(w, -i), -i);
+    ASSERT_EQ(vec_header_(w)->inline_, 0);
+
+    // Growing an earlier one copies it
+    ASSERT_EQ(*vec_push(v, 100), 100);
+    for (int i = 0; i <= 100; i++)
+        ASSERT_EQ(v[i], i);
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(w[i], -i);
+
+    // Released with the arena
+    vec_free(v);
+    vec_free(w);
+    jz_arena_free(&a);
+}
@@ -0,0 +1,243 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cache.h>
+#include <token.h>
+
+#include "test.h"
+
+#define SRC(s) (const uint8_t *)(s), strlen(s)
+
+TEST(cache_hash128)
+{
+    struct jz_hash h;
+
+    h = jz_hash128("", 0, 0);
+    ASSERT_EQ(h.lo, 0);
+    ASSERT_EQ(h.hi, 0);
+
+    h = jz_hash128("hello", 5, 0);
+    ASSERT_EQ(h.lo, 0xcbd8a7b341bd9b02ull);
+    ASSERT_EQ(h.hi, 0x5b1e906a48ae1d19ull);
+
+    h = jz_hash128("0123456789abcdef0", 17, 0);
+    ASSERT_EQ(h.lo, 0xeb24ae8785a5c075ull);
+    ASSERT_EQ(h.hi, 0x73fb68b3313128caull);
+}
+
+TEST(cache_hit)
+{
+    const struct jz_tokens *a, *b, *c;
+    struct jz_cache_stats stats;
+    struct jz_cache cache;
+
+    ASSERT_EQ(jz_cache_init(&cache, 1 << 20, NULL), 0);
+
+    a = jz_cache_tokenize(&cache, SRC("foo(bar);"));
+    ASSERT_NE(a, NULL);
+    ASSERT_EQ(a->count, 6);
+    ASSERT_EQ(a->tokens[0].type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(memcmp(a->tokens[0].id.str, "foo", 4), 0);
+    ASSERT_EQ(memcmp(a->tokens[2].id.str, "bar", 4), 0);
+    ASSERT_EQ(a->tokens[5].type, TOKEN_EOF);
+
+    // Same bytes from a different buffer share the tokens
+    char copy[] = "foo(bar);";
+    b = jz_cache_tokenize(&cache, SRC(copy));
+    ASSERT_EQ(b, a);
+
+    c = jz_cache_tokenize(&cache, SRC("foo(baz);"));
+    ASSERT_NE(c, a);
+
+    jz_cache_get_stats(&cache, &stats);
+    ASSERT_EQ(stats.hits, 1);
+    ASSERT_EQ(stats.misses, 2);
+    ASSERT_EQ(stats.evictions, 0);
+    ASSERT_EQ(stats.entries, 2);
+
+    jz_cache_release(&cache, a);
+    jz_cache_release(&cache, b);
+    jz_cache_release(&cache, c);
+    jz_cache_free(&cache);
+}
+
+TEST(cache_eviction)
+{
+    const struct jz_tokens *a, *b;
+    struct jz_cache_stats stats;
+    struct jz_cache cache;
+
+    // Room for about one small entry
+    ASSERT_EQ(jz_cache_init(&cache, 1024, NULL), 0);
+
+    a = jz_cache_tokenize(&cache, SRC("a;"));
+    b = jz_cache_tokenize(&cache, SRC("b;"));
+    ASSERT_NE(a, NULL);
+    ASSERT_NE(b, NULL);
+
+    jz_cache_get_stats(&cache, &stats);
+    ASSERT_EQ(stats.evictions, 1);
+    ASSERT_EQ(stats.entries, 1);
+    ASSERT_LE(stats.bytes, 1024);
+
+    // Evicted tokens stay valid until released
+    ASSERT_EQ(memcmp(a->tokens[0].id.str, "a", 2), 0);
+    jz_cache_release(&cache, a);
+    jz_cache_release(&cache, b);
+
+    a = jz_cache_tokenize(&cache, SRC("a;"));
+    jz_cache_get_stats(&cache, &stats);
+    ASSERT_EQ(stats.misses, 3);
+    jz_cache_release(&cache, a);
+
+    jz_cache_free(&cache);
+}
+
+static void remove_dir(const char *dir)
+{
+    struct dirent *ent;
+    DIR *d;
+
+    if (!(d = opendir(dir)))
+        return;
+    while ((ent = readdir(d))) {
+        if (ent->d_name[0] == '.')
+            continue;
+        unlinkat(dirfd(d), ent->d_name, 0);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+TEST(cache_dir)
+{
+    char dir[] = "/tmp/jz_cache_XXXXXX";
+    const struct jz_tokens *a;
+    struct jz_cache_stats stats;
+    struct jz_cache cache;
+
+    ASSERT_NE(mkdtemp(dir), NULL);
+
+    ASSERT_EQ(jz_cache_init(&cache, 1 << 20, dir), 0);
+    a = jz_cache_tokenize(&cache, SRC("let x = `t`; y"));
+    ASSERT_NE(a, NULL);
+    jz_cache_release(&cache, a);
+    jz_cache_free(&cache);
+
+    // A new cache finds the entry on disk
+    ASSERT_EQ(jz_cache_init(&cache, 1 << 20, dir), 0);
+    a = jz_cache_tokenize(&cache, SRC("let x = `t`; y"));
+    ASSERT_NE(a, NULL);
+    ASSERT_EQ(a->count, 7);
+    ASSERT_EQ(a->tokens[3].type, TOKEN_ERROR);
+    ASSERT_EQ(memcmp(a->tokens[5].id.str, "y", 2), 0);
+    ASSERT_EQ(a->tokens[6].type, TOKEN_EOF);
+
+    jz_cache_get_stats(&cache, &stats);
+    ASSERT_EQ(stats.disk_hits, 1);
+    ASSERT_EQ(stats.misses, 0);
+    jz_cache_release(&cache, a);
+    jz_cache_free(&cache);
+
+    remove_dir(dir);
+}
+
+static void entry_file(char *path, size_t len, const char *dir, const char *src)
+{
+    const struct jz_hash hash = jz_hash128(src, strlen(src), 0);
+
+    snprintf(path, len, "%s/%016llx%016llx.tok", dir,
+        (unsigned long long)hash.lo, (unsigned long long)hash.hi);
+}
+
+// Another input's entry under this input's hash, as with a collision, is
+// not used
+TEST(cache_dir_collision)
+{
+    char dir[] = "/tmp/jz_cache_XXXXXX";
+    char path_a[64], path_b[64];
+    const struct jz_tokens *a;
+    struct jz_cache_stats stats;
+    struct jz_cache cache;
+
+    ASSERT_NE(mkdtemp(dir), NULL);
+    entry_file(path_a, sizeof(path_a), dir, "a = b;");
+    entry_file(path_b, sizeof(path_b), dir, "c = d;");
+
+    ASSERT_EQ(jz_cache_init(&cache, 1 << 20, dir), 0);
+    a = jz_cache_tokenize(&cache, SRC("a = b;"));
+    ASSERT_NE(a, NULL);
+    jz_cache_release(&cache, a);
+    jz_cache_free(&cache);
+    ASSERT_EQ(rename(path_a, path_b), 0);
+
+    ASSERT_EQ(jz_cache_init(&cache, 1 << 20, dir), 0);
+    a = jz_cache_tokenize(&cache, SRC("c = d;"));
+    ASSERT_NE(a, NULL);
+    ASSERT_EQ(memcmp(a->tokens[0].id.str, "c", 2), 0);
+
+    jz_cache_get_stats(&cache, &stats);
+    ASSERT_EQ(stats.disk_hits, 0);
+    ASSERT_EQ(stats.misses, 1);
+    jz_cache_release(&cache, a);
+    jz_cache_free(&cache);
+
+    remove_dir(dir);
+}
+
+// Damaging any byte of an entry either makes it a miss or leaves tokens that
+// are still consistent with the input
+TEST(cache_dir_damaged)
+{
+    const char *src = "if (x) { return `a` + yz; } // done";
+    char dir[] = "/tmp/jz_cache_XXXXXX";
+    char path[64];
+    uint8_t file[4096];
+    const struct jz_tokens *a;
+    struct jz_cache cache;
+    ssize_t len;
+    int fd;
+
+    ASSERT_NE(mkdtemp(dir), NULL);
+    entry_file(path, sizeof(path), dir, src);
+
+    ASSERT_EQ(jz_cache_init(&cache, 1 << 20, dir), 0);
+    a = jz_cache_tokenize(&cache, SRC(src));
+    ASSERT_NE(a, NULL);
+    jz_cache_release(&cache, a);
+    jz_cache_free(&cache);
+
+    ASSERT_GE(fd = open(path, O_RDONLY), 0);
+    ASSERT_GT(len = read(fd, file, sizeof(file)), 0);
+    ASSERT_LT(len, sizeof(file));
+    close(fd);
+
+    for (ssize_t i = 0; i < len; i++) {
+        file[i] ^= 0x80;
+        ASSERT_GE(fd = open(path, O_WRONLY | O_TRUNC), 0);
+        ASSERT_EQ(write(fd, file, len), len);
+        close(fd);
+        file[i] ^= 0x80;
+
+        ASSERT_EQ(jz_cache_init(&cache, 1 << 20, dir), 0);
+        a = jz_cache_tokenize(&cache, SRC(src));
+        ASSERT_NE(a, NULL);
+        ASSERT_EQ(a->tokens[a->count - 1].type, TOKEN_EOF);
+        for (size_t j = 0; j < a->count; j++) {
+            const struct token *tok = &a->tokens[j];
+
+            ASSERT_LE(tok->start, tok->end);
+            ASSERT_LE(tok->end, strlen(src));
+            if (tok->id.str)
+                ASSERT_EQ(tok->id.str[tok->id.len - 1], '\0');
+        }
+        jz_cache_release(&cache, a);
+        jz_cache_free(&cache);
+    }
+
+    remove_dir(dir);
+}
@@ -0,0 +1,126 @@
+#include <string.h>
+
+#include <json.h>
+#include <token.h>
+
+#include "test.h"
+
+#define ASSERT_JSON_TOKEN(json, type_, start_, end_) do { \
+    struct token tok;                                     \
+    ASSERT_EQ(jz_json_next_token(json, &tok), 0);         \
+    ASSERT_EQ(tok.type, type_);                           \
+    ASSERT_EQ(tok.start, start_);                         \
+    ASSERT_EQ(tok.end, end_); } while (0)
+
+#define ASSERT_JSON_FAIL(str, error_, index_) do {               \
+    struct jz_json json;                                         \
+    struct token tok;                                            \
+    int status_;                                                 \
+    ASSERT_EQ(jz_json_init(&json, (void *)str, strlen(str)), 0); \
+    do {                                                         \
+        status_ = jz_json_next_token(&json, &tok);               \
+    } while (status_ == 0 && tok.type != TOKEN_EOF);             \
+    ASSERT_EQ(status_, -1);                                      \
+    ASSERT_EQ(json.error, error_);                               \
+    ASSERT_EQ(json.error_index, index_);                         \
+    jz_json_free(&json); } while (0)
+
+TEST(json_tokens)
+{
+    const char *str = "{\"a\": [1, -2.5e+3,true,false, null],\n\t\"b\\\"c\": \"\\u00e9\xc3\xa9\"}";
+    struct jz_json json;
+
+    ASSERT_EQ(jz_json_init(&json, (void *)str, strlen(str)), 0);
+    ASSERT_JSON_TOKEN(&json, TOKEN_BRACE_LEFT, 0, 1);
+    ASSERT_JSON_TOKEN(&json, TOKEN_STRING_LITERAL, 1, 4);
+    ASSERT_JSON_TOKEN(&json, TOKEN_COLON, 4, 5);
+    ASSERT_JSON_TOKEN(&json, TOKEN_SQUARE_LEFT, 6, 7);
+    ASSERT_JSON_TOKEN(&json, TOKEN_NUMERIC_LITERAL, 7, 8);
+    ASSERT_JSON_TOKEN(&json, TOKEN_COMMA, 8, 9);
+    ASSERT_JSON_TOKEN(&json, TOKEN_NUMERIC_LITERAL, 10, 17);
+    ASSERT_JSON_TOKEN(&json, TOKEN_COMMA, 17, 18);
+    ASSERT_JSON_TOKEN(&json, TOKEN_TRUE, 18, 22);
+    ASSERT_JSON_TOKEN(&json, TOKEN_COMMA, 22, 23);
+    ASSERT_JSON_TOKEN(&json, TOKEN_FALSE, 23, 28);
+    ASSERT_JSON_TOKEN(&json, TOKEN_COMMA, 28, 29);
+    ASSERT_JSON_TOKEN(&json, TOKEN_NULL, 30, 34);
+    ASSERT_JSON_TOKEN(&json, TOKEN_SQUARE_RIGHT, 34, 35);
+    ASSERT_JSON_TOKEN(&json, TOKEN_COMMA, 35, 36);
+    ASSERT_JSON_TOKEN(&json, TOKEN_STRING_LITERAL, 38, 44);
+    ASSERT_JSON_TOKEN(&json, TOKEN_COLON, 44, 45);
+    ASSERT_JSON_TOKEN(&json, TOKEN_STRING_LITERAL, 46, 56);
+    ASSERT_JSON_TOKEN(&json, TOKEN_BRACE_RIGHT, 56, 57);
+    ASSERT_JSON_TOKEN(&json, TOKEN_EOF, 57, 57);
+    ASSERT_JSON_TOKEN(&json, TOKEN_EOF, 57, 57);
+    jz_json_free(&json);
+
+    ASSERT_EQ(jz_json_init(&json, (void *)"", 0), 0);
+    ASSERT_JSON_TOKEN(&json, TOKEN_EOF, 0, 0);
+    jz_json_free(&json);
+}
+
+// Strings and numbers around the edges of the 64-byte blocks, with runs of
+// backslashes of every parity
+TEST(json_blocks)
+{
+    char str[256];
+    struct jz_json json;
+
+    for (size_t offset = 48; offset < 80; offset++) {
+        for (size_t backslashes = 1; backslashes <= 5; backslashes++) {
+            size_t n = 0, string, end;
+
+            str[n++] = '[';
+            memset(&str[n], ' ', offset);
+            n += offset;
+
+            // An odd run escapes the quote after it
+            string = n;
+            str[n++] = '"';
+            memset(&str[n], '\\', backslashes);
+            n += backslashes;
+            if (backslashes % 2)
+                str[n++] = '"';
+            str[n++] = '"';
+            end = n;
+
+            memcpy(&str[n], ",12345]", 7);
+            n += 7;
+
+            ASSERT_EQ(jz_json_init(&json, (void *)str, n), 0);
+            ASSERT_JSON_TOKEN(&json, TOKEN_SQUARE_LEFT, 0, 1);
+            ASSERT_JSON_TOKEN(&json, TOKEN_STRING_LITERAL, string, end);
+            ASSERT_JSON_TOKEN(&json, TOKEN_COMMA, end, end + 1);
+            ASSERT_JSON_TOKEN(&json, TOKEN_NUMERIC_LITERAL, end + 1, end + 6);
+            ASSERT_JSON_TOKEN(&json, TOKEN_SQUARE_RIGHT, end + 6, end + 7);
+            ASSERT_JSON_TOKEN(&json, TOKEN_EOF, n, n);
+            jz_json_free(&json);
+        }
+    }
+}
+
+TEST(json_errors)
+{
+    ASSERT_JSON_FAIL("[\"abc", JZ_ERROR_INVALID_STRING, 1);
+    ASSERT_JSON_FAIL("[\"a\\\"]", JZ_ERROR_INVALID_STRING, 1);
+    ASSERT_JSON_FAIL("\"a\\x\"", JZ_ERROR_INVALID_STRING, 2);
+    ASSERT_JSON_FAIL("\"\\u12g4\"", JZ_ERROR_INVALID_STRING, 1);
+    ASSERT_JSON_FAIL("\"\\u12\"", JZ_ERROR_INVALID_STRING, 1);
+    ASSERT_JSON_FAIL("\"a\tb\"", JZ_ERROR_INVALID_STRING, 2);
+    ASSERT_JSON_FAIL("\"aaaaaaaaaaaaaaaaaaaa\nb\"", JZ_ERROR_INVALID_STRING, 21);
+    ASSERT_JSON_FAIL("\"\xc3\"", JZ_ERROR_INVALID_STRING, 1);
+    ASSERT_JSON_FAIL("\"\xc0\x80\"", JZ_ERROR_INVALID_STRING, 1);
+    ASSERT_JSON_FAIL("\"\xed\xa0\x80\"", JZ_ERROR_INVALID_STRING, 1);
+
+    ASSERT_JSON_FAIL("[01]", JZ_ERROR_INVALID_NUMBER, 1);
+    ASSERT_JSON_FAIL("[1.]", JZ_ERROR_INVALID_NUMBER, 1);
+    ASSERT_JSON_FAIL("[-]", JZ_ERROR_INVALID_NUMBER, 1);
+    ASSERT_JSON_FAIL("[1e]", JZ_ERROR_INVALID_NUMBER, 1);
+    ASSERT_JSON_FAIL("[+1]", JZ_ERROR_INVALID_CHARACTER, 1);
+    ASSERT_JSON_FAIL("[1x]", JZ_ERROR_INVALID_NUMBER, 1);
+
+    ASSERT_JSON_FAIL("[tru]", JZ_ERROR_INVALID_CHARACTER, 1);
+    ASSERT_JSON_FAIL("[nulll]", JZ_ERROR_INVALID_CHARACTER, 1);
+    ASSERT_JSON_FAIL("{'a': 1}", JZ_ERROR_INVALID_CHARACTER, 1);
+    ASSERT_JSON_FAIL("[1,\v2]", JZ_ERROR_INVALID_CHARACTER, 3);
+}
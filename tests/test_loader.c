@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <loader.h>
+#include <tokenizer.h>
+
+#include "test.h"
+
+#define NFILES 4
+
+struct results
+{
+    pthread_mutex_t lock;
+    struct jz_file files[NFILES];
+    size_t calls;
+};
+
+static void collect(const struct jz_file *file, void *data)
+{
+    struct results *results = data;
+
+    pthread_mutex_lock(&results->lock);
+    results->files[file->index] = *file;
+    results->calls++;
+    pthread_mutex_unlock(&results->lock);
+}
+
+// Writes the test files to dir, the last one of which is left missing
+static void setup(char *dir, char paths[NFILES][64], char *big, size_t big_size)
+{
+    FILE *fp;
+
+    snprintf(paths[0], 64, "%s/empty.js", dir);
+    snprintf(paths[1], 64, "%s/small.js", dir);
+    snprintf(paths[2], 64, "%s/big.js", dir);
+    snprintf(paths[3], 64, "%s/missing.js", dir);
+
+    for (size_t i = 0; i < big_size; i++)
+        big[i] = "ab; "[i % 4];
+
+    if ((fp = fopen(paths[0], "w")))
+        fclose(fp);
+    if ((fp = fopen(paths[1], "w"))) {
+        fputs("let a;", fp);
+        fclose(fp);
+    }
+    if ((fp = fopen(paths[2], "w"))) {
+        fwrite(big, 1, big_size, fp);
+        fclose(fp);
+    }
+}
+
+#define ASSERT_LOADED(results, big, big_size) do {                          \
+    ASSERT_EQ((results).calls, NFILES);                                     \
+    ASSERT_EQ((results).files[0].error, 0);                                 \
+    ASSERT_EQ((results).files[0].size, 0);                                  \
+    ASSERT_EQ((results).files[0].bytes[0], 0);                              \
+    ASSERT_EQ((results).files[1].size, 6);                                  \
+    ASSERT_EQ(memcmp((results).files[1].bytes, "let a;", 7), 0);            \
+    ASSERT_EQ((results).files[2].size, big_size);                           \
+    ASSERT_EQ(memcmp((results).files[2].bytes, big, big_size), 0);          \
+    ASSERT_EQ((results).files[2].bytes[big_size + JZ_PADDING - 1], 0);      \
+    ASSERT_EQ((results).files[3].error, ENOENT);                            \
+    ASSERT_EQ((results).files[3].bytes, NULL);                              \
+    for (size_t i_ = 0; i_ < NFILES; i_++)                                  \
+        free((results).files[i_].bytes); } while (0)
+
+TEST(loader_files)
+{
+    const size_t big_size = 300000;
+    char dir[] = "/tmp/jz_loader_XXXXXX";
+    char paths[NFILES][64];
+    const char *list[NFILES];
+    struct results results;
+    char *big = malloc(big_size);
+
+    ASSERT_NE(mkdtemp(dir), NULL);
+    setup(dir, paths, big, big_size);
+    for (size_t i = 0; i < NFILES; i++)
+        list[i] = paths[i];
+
+    memset(&results, 0, sizeof(results));
+    pthread_mutex_init(&results.lock, NULL);
+    ASSERT_EQ(jz_load_files_threads(list, NFILES, 3, collect, &results), 0);
+    ASSERT_LOADED(results, big, big_size);
+
+    // Fewer slots than files, so that they are reused
+    memset(&results, 0, sizeof(results));
+    pthread_mutex_init(&results.lock, NULL);
+    if (jz_load_files_uring(list, NFILES, 2, collect, &results) == 0) {
+        ASSERT_LOADED(results, big, big_size);
+    } else {
+        ASSERT_EQ(errno, ENOSYS);
+        ASSERT_EQ(results.calls, 0);
+    }
+
+    memset(&results, 0, sizeof(results));
+    pthread_mutex_init(&results.lock, NULL);
+    ASSERT_EQ(jz_load_files(list, NFILES, 8, collect, &results), 0);
+    ASSERT_LOADED(results, big, big_size);
+
+    for (size_t i = 0; i < NFILES - 1; i++)
+        unlink(paths[i]);
+    rmdir(dir);
+    free(big);
+}
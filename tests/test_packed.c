@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <packed.h>
+#include <token.h>
+#include <tokenizer.h>
+#include <vec.h>
+
+#include "test.h"
+
+TEST(packed_tokens)
+{
+    const char *str = "a = \\u0062;\n  c(d)";
+    struct jz_packed_tokens p;
+    struct context ctx, expected;
+    struct token tok, want;
+
+    jz_packed_init(&p);
+    jz_context_init(&ctx, (void *)str, strlen(str));
+    ASSERT_EQ(jz_pack_tokens(&p, &ctx, next_token), 0);
+    ASSERT_EQ(vec_len(p.tokens), 9);
+    ASSERT_EQ(vec_len(p.long_tokens), 0);
+
+    jz_context_init(&expected, (void *)str, strlen(str));
+    for (size_t i = 0; i < vec_len(p.tokens); i++) {
+        ASSERT_EQ(next_token(&expected, &want), 0);
+        jz_unpack_token(&p, i, &tok);
+        ASSERT_EQ(tok.type, want.type);
+        ASSERT_EQ(tok.start, want.start);
+        ASSERT_EQ(tok.end, want.end);
+        ASSERT_EQ(tok.newline_before, want.newline_before);
+        ASSERT_EQ(tok.id.str, NULL);
+
+        // Payloads are decoded again from the source
+        if (tok.type == TOKEN_IDENTIFIER) {
+            ASSERT_EQ(jz_unpack_payload(&ctx, &tok), 0);
+            ASSERT_EQ(tok.id.len, want.id.len);
+            ASSERT_EQ(memcmp(tok.id.str, want.id.str, want.id.len), 0);
+            vec_free(tok.id.str);
+        }
+        vec_free(want.id.str);
+    }
+
+    jz_packed_free(&p);
+}
+
+TEST(packed_tokens_error)
+{
+    const char *str = "f(1, 'a', `b`) @";
+    const int errors[] = {
+        JZ_ERROR_NUMERIC_LITERAL, JZ_ERROR_STRING_LITERAL,
+        JZ_ERROR_TEMPLATE_LITERAL, JZ_ERROR_INVALID_CHARACTER,
+    };
+    struct jz_packed_tokens p;
+    struct context ctx;
+    struct token tok;
+    size_t n = 0;
+
+    jz_packed_init(&p);
+    jz_context_init(&ctx, (void *)str, strlen(str));
+    ASSERT_EQ(jz_pack_tokens(&p, &ctx, jz_next_token_recover), 0);
+    ASSERT_EQ(vec_len(p.tokens), 10);
+
+    // The reason of every TOKEN_ERROR is kept
+    for (size_t i = 0; i < vec_len(p.tokens); i++) {
+        jz_unpack_token(&p, i, &tok);
+        if (tok.type == TOKEN_ERROR)
+            ASSERT_EQ(tok.error, errors[n++]);
+    }
+    ASSERT_EQ(n, 4);
+
+    jz_context_free(&ctx);
+    jz_packed_free(&p);
+}
+
+TEST(packed_tokens_long)
+{
+    const size_t lens[] = { JZ_PACKED_LEN_MAX - 1, JZ_PACKED_LEN_MAX, 100000, 3 };
+    struct jz_packed_tokens p;
+    struct token tok = { 0 };
+    size_t start = 0;
+
+    jz_packed_init(&p);
+    for (size_t i = 0; i < 4; i++) {
+        tok.type = TOKEN_ERROR;
+        tok.start = start;
+        tok.end = start + lens[i];
+        ASSERT_EQ(jz_pack_token(&p, &tok), 0);
+        start = tok.end;
+    }
+    ASSERT_EQ(vec_len(p.long_tokens), 2);
+
+    start = 0;
+    for (size_t i = 0; i < 4; i++) {
+        jz_unpack_token(&p, i, &tok);
+        ASSERT_EQ(tok.start, start);
+        ASSERT_EQ(tok.end - tok.start, lens[i]);
+        start = tok.end;
+    }
+
+    // Offsets are 32 bits
+    tok.start = (size_t)UINT32_MAX + 1;
+    tok.end = tok.start + 1;
+    ASSERT_EQ(jz_pack_token(&p, &tok), -1);
+    ASSERT_EQ(vec_len(p.tokens), 4);
+
+    jz_packed_free(&p);
+}
+
+TEST(packed_tokens_utf16)
+{
+    const uint16_t units[] = { 'x', ' ', 0xe9, 'b', '\\', 'u', '0', '0', '6', '3' };
+    struct jz_packed_tokens p;
+    struct context ctx;
+    struct token tok;
+
+    jz_packed_init(&p);
+    jz_context_init_utf16(&ctx, units, sizeof(units) / sizeof(*units));
+    ASSERT_EQ(jz_pack_tokens(&p, &ctx, jz_next_token_utf16), 0);
+    ASSERT_EQ(vec_len(p.tokens), 3);
+
+    jz_unpack_token(&p, 1, &tok);
+    ASSERT_EQ(tok.start, 2);
+    ASSERT_EQ(tok.end, 10);
+    ASSERT_EQ(jz_unpack_payload(&ctx, &tok), 0);
+    ASSERT_EQ(memcmp(tok.id.str, "\xc3\xa9" "bc", 5), 0);
+    vec_free(tok.id.str);
+
+    jz_packed_free(&p);
+}
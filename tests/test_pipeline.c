@@ -0,0 +1,103 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pipeline.h>
+#include <token.h>
+#include <tokenizer.h>
+#include <vec.h>
+
+#include "test.h"
+
+TEST(pipeline_batches)
+{
+    struct token tok = { .type = TOKEN_SEMICOLON };
+    const struct jz_batch *batch;
+    struct jz_pipeline p;
+
+    ASSERT_EQ(jz_pipeline_init(&p, 2), 0);
+    ASSERT_EQ(jz_pipeline_try_pop(&p), NULL);
+
+    // A batch is handed over once full
+    for (int i = 0; i < JZ_PIPELINE_BATCH + 1; i++)
+        jz_pipeline_push(&p, &tok);
+    ASSERT_NE((batch = jz_pipeline_try_pop(&p)), NULL);
+    ASSERT_EQ(batch->count, JZ_PIPELINE_BATCH);
+    ASSERT_EQ(jz_pipeline_try_pop(&p), NULL);
+    jz_pipeline_release(&p);
+
+    // Or when flushed
+    jz_pipeline_close(&p);
+    ASSERT_EQ(jz_pipeline_done(&p), false);
+    ASSERT_NE((batch = jz_pipeline_pop(&p)), NULL);
+    ASSERT_EQ(batch->count, 1);
+    jz_pipeline_release(&p);
+
+    ASSERT_EQ(jz_pipeline_done(&p), true);
+    ASSERT_EQ(jz_pipeline_pop(&p), NULL);
+    jz_pipeline_free(&p);
+}
+
+struct producer
+{
+    struct jz_pipeline *p;
+    struct context ctx;
+    int status;
+};
+
+static void *produce(void *data)
+{
+    struct producer *producer = data;
+
+    producer->status = jz_pipeline_tokenize(producer->p, &producer->ctx, next_token);
+    return NULL;
+}
+
+TEST(pipeline_threads)
+{
+    const size_t n = 100000;
+    char *str = malloc(n * 4 + 1);
+    const struct jz_batch *batch;
+    struct producer producer;
+    struct jz_pipeline p;
+    size_t count = 0;
+    bool eof = false;
+    pthread_t thread;
+
+    for (size_t i = 0; i < n; i++)
+        memcpy(&str[i * 4], "ab; ", 4);
+    str[n * 4] = '\0';
+
+    // A small ring, so that the producer has to wait
+    ASSERT_EQ(jz_pipeline_init(&p, 4), 0);
+    producer.p = &p;
+    jz_context_init(&producer.ctx, (void *)str, n * 4);
+    ASSERT_EQ(pthread_create(&thread, NULL, produce, &producer), 0);
+
+    while ((batch = jz_pipeline_pop(&p))) {
+        for (size_t i = 0; i < batch->count; i++) {
+            const struct token *tok = &batch->tokens[i];
+            if (tok->type == TOKEN_EOF) {
+                eof = true;
+                continue;
+            }
+
+            // Tokens arrive in order
+            ASSERT_EQ(tok->type, count % 2 ? TOKEN_SEMICOLON : TOKEN_IDENTIFIER);
+            ASSERT_EQ(tok->start, count / 2 * 4 + count % 2 * 2);
+            if (tok->type == TOKEN_IDENTIFIER)
+                ASSERT_EQ(memcmp(tok->id.str, "ab", 3), 0);
+            vec_free(tok->id.str);
+            count++;
+        }
+        jz_pipeline_release(&p);
+    }
+
+    ASSERT_EQ(pthread_join(thread, NULL), 0);
+    ASSERT_EQ(producer.status, 0);
+    ASSERT_EQ(eof, true);
+    ASSERT_EQ(count, n * 2);
+
+    jz_pipeline_free(&p);
+    free(str);
+}
@@ -0,0 +1,173 @@
+#include <string.h>
+#include <unistd.h>
+
+#include <printer.h>
+#include <token.h>
+#include <tokenizer.h>
+#include <vec.h>
+
+#include "test.h"
+
+#define IDENT(s) { .type = TOKEN_IDENTIFIER, .id = { (uint8_t *)s, sizeof(s) } }
+#define PUNCT(t) { .type = t }
+
+#define ASSERT_WRITE(format_, tokens, expected) do {                  \
+    struct jz_writer w;                                               \
+    uint8_t buf[256];                                                 \
+    jz_writer_init(&w, buf, sizeof(buf), -1, format_);                \
+    for (size_t i = 0; i < sizeof(tokens) / sizeof(*tokens); i++)     \
+        ASSERT_EQ(jz_write_token(&w, &tokens[i]), 0);                 \
+    ASSERT_EQ(w.len, strlen(expected));                               \
+    ASSERT_EQ(memcmp(buf, expected, w.len), 0); } while (0)
+
+TEST(printer_compact)
+{
+    struct token words[] = {
+        PUNCT(TOKEN_RETURN), IDENT("a"), PUNCT(TOKEN_INSTANCEOF), IDENT("b"),
+        PUNCT(TOKEN_SEMICOLON), PUNCT(TOKEN_EOF),
+    };
+    ASSERT_WRITE(JZ_FORMAT_COMPACT, words, "return a instanceof b;");
+
+    struct token ops[] = {
+        IDENT("a"), PUNCT(TOKEN_PLUS), PUNCT(TOKEN_PLUS_PLUS), IDENT("b"),
+        PUNCT(TOKEN_MINUS), PUNCT(TOKEN_MINUS_EQUALS), PUNCT(TOKEN_PAREN_LEFT),
+        PUNCT(TOKEN_PAREN_RIGHT), PUNCT(TOKEN_GREATER), PUNCT(TOKEN_EQUALS),
+    };
+    ASSERT_WRITE(JZ_FORMAT_COMPACT, ops, "a+ ++b- -=()> =");
+
+    struct token comments[] = {
+        PUNCT(TOKEN_SLASH), PUNCT(TOKEN_SLASH), PUNCT(TOKEN_SLASH_EQUALS),
+        PUNCT(TOKEN_ASTERISK), PUNCT(TOKEN_DOT), PUNCT(TOKEN_DOT),
+        PUNCT(TOKEN_DOT),
+    };
+    ASSERT_WRITE(JZ_FORMAT_COMPACT, comments, "/ / /=*. . .");
+}
+
+#define LINE(t) { .type = t, .newline_before = true }
+#define LINE_IDENT(s) { .type = TOKEN_IDENTIFIER, .id = { (uint8_t *)s, sizeof(s) }, \
+    .newline_before = true }
+
+TEST(printer_compact_lines)
+{
+    struct token restricted[] = {
+        PUNCT(TOKEN_RETURN), LINE_IDENT("x"), PUNCT(TOKEN_EOF),
+    };
+    ASSERT_WRITE(JZ_FORMAT_COMPACT, restricted, "return\nx");
+
+    struct token statements[] = {
+        IDENT("a"), LINE_IDENT("b"), LINE(TOKEN_PLUS_PLUS), IDENT("c"),
+        PUNCT(TOKEN_PAREN_LEFT), PUNCT(TOKEN_PAREN_RIGHT), LINE_IDENT("d"),
+    };
+    ASSERT_WRITE(JZ_FORMAT_COMPACT, statements, "a\nb\n++c()\nd");
+
+    // Nothing ends before these breaks, so they are dropped
+    struct token operators[] = {
+        IDENT("a"), PUNCT(TOKEN_EQUALS), LINE_IDENT("b"), PUNCT(TOKEN_PLUS),
+        LINE(TOKEN_PAREN_LEFT), LINE_IDENT("c"), PUNCT(TOKEN_PAREN_RIGHT),
+    };
+    ASSERT_WRITE(JZ_FORMAT_COMPACT, operators, "a=b+(c)");
+}
+
+TEST(printer_compact_source)
+{
+    const char *str = "x = 'str' + 1\n.5 .toFixed(y)\n`a${b}` @";
+    struct context ctx;
+    struct jz_writer w;
+    struct token tok;
+    uint8_t buf[256];
+
+    jz_writer_init(&w, buf, sizeof(buf), -1, JZ_FORMAT_COMPACT);
+    w.source = (const uint8_t *)str;
+    jz_context_init(&ctx, (void *)str, strlen(str));
+    do {
+        ASSERT_EQ(jz_next_token_recover(&ctx, &tok), 0);
+        ASSERT_EQ(jz_write_token(&w, &tok), 0);
+        vec_free(tok.id.str);
+    } while (tok.type != TOKEN_EOF);
+    jz_context_free(&ctx);
+
+    ASSERT_EQ(w.len, strlen("x='str'+1\n.5 .toFixed(y)\n`a${b}` @"));
+    ASSERT_EQ(memcmp(buf, "x='str'+1\n.5 .toFixed(y)\n`a${b}` @", w.len), 0);
+
+    // Without the source, the literal cannot be written
+    struct token literal[] = {
+        { .type = TOKEN_ERROR, .start = 0, .end = 1, .error = JZ_ERROR_STRING_LITERAL },
+    };
+    jz_writer_init(&w, buf, sizeof(buf), -1, JZ_FORMAT_COMPACT);
+    ASSERT_EQ(jz_write_token(&w, &literal[0]), -1);
+}
+
+// Output that would contain an HTML-like comment is spaced so that it reads
+// back as the same tokens
+TEST(printer_compact_html_comments)
+{
+    const char *str = "a < !--b\nx\n-- > y";
+    const char *expected = "a< !--b\nx\n-- >y";
+    struct context ctx, out;
+    struct jz_writer w;
+    struct token tok, again;
+    uint8_t buf[256];
+
+    jz_writer_init(&w, buf, sizeof(buf), -1, JZ_FORMAT_COMPACT);
+    jz_context_init(&ctx, (void *)str, strlen(str));
+    do {
+        ASSERT_EQ(next_token(&ctx, &tok), 0);
+        ASSERT_EQ(jz_write_token(&w, &tok), 0);
+        vec_free(tok.id.str);
+    } while (tok.type != TOKEN_EOF);
+
+    ASSERT_EQ(w.len, strlen(expected));
+    ASSERT_EQ(memcmp(buf, expected, w.len), 0);
+
+    jz_context_init(&ctx, (void *)str, strlen(str));
+    jz_context_init(&out, buf, w.len);
+    do {
+        ASSERT_EQ(next_token(&ctx, &tok), 0);
+        ASSERT_EQ(next_token(&out, &again), 0);
+        ASSERT_EQ(again.type, tok.type);
+        vec_free(tok.id.str);
+        vec_free(again.id.str);
+    } while (tok.type != TOKEN_EOF);
+}
+
+TEST(printer_debug)
+{
+    struct token tokens[] = {
+        IDENT("id"), PUNCT(TOKEN_SEMICOLON),
+        { .type = TOKEN_ERROR, .error = JZ_ERROR_INVALID_CHARACTER },
+        PUNCT(TOKEN_EOF),
+    };
+    ASSERT_WRITE(JZ_FORMAT_DEBUG, tokens, "IDENTIFIER id\nSEMICOLON\n"
+        "ERROR invalid or unexpected character\nEOF\n");
+}
+
+TEST(printer_buffer_full)
+{
+    struct jz_writer w;
+    uint8_t buf[4];
+
+    jz_writer_init(&w, buf, sizeof(buf), -1, JZ_FORMAT_COMPACT);
+    ASSERT_EQ(jz_write(&w, "abc", 3), 0);
+    ASSERT_EQ(jz_write(&w, "de", 2), -1);
+    ASSERT_EQ(w.len, 3);
+}
+
+TEST(printer_fd)
+{
+    struct jz_writer w;
+    uint8_t buf[4];
+    char out[32] = { 0 };
+    int fds[2];
+
+    ASSERT_EQ(pipe(fds), 0);
+    jz_writer_init(&w, buf, sizeof(buf), fds[1], JZ_FORMAT_COMPACT);
+    ASSERT_EQ(jz_write(&w, "abc", 3), 0);
+    ASSERT_EQ(jz_write(&w, "de", 2), 0);
+    ASSERT_EQ(jz_write(&w, "fghijk", 6), 0);
+    ASSERT_EQ(jz_writer_flush(&w), 0);
+    close(fds[1]);
+
+    ASSERT_EQ(read(fds[0], out, sizeof(out)), 11);
+    ASSERT_EQ(strcmp(out, "abcdefghijk"), 0);
+    close(fds[0]);
+}
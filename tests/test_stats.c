@@ -0,0 +1,75 @@
+#ifdef JZ_INSTRUMENT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <token.h>
+#include <tokenizer.h>
+#include <vec.h>
+
+#include "test.h"
+
+static void count_tokens(const struct context *ctx, const struct token *tok, void *data)
+{
+    (void)ctx;
+    (void)tok;
+    (*(size_t *)data)++;
+}
+
+TEST(stats_counters)
+{
+    const char *str = "a = \\u0062 + caf\xc3\xa9; // x\n";
+    struct context ctx;
+    struct token tok;
+    size_t traced = 0;
+
+    jz_context_init(&ctx, (void *)str, strlen(str));
+    ctx.trace = count_tokens;
+    ctx.trace_data = &traced;
+
+    do {
+        ASSERT_EQ(next_token(&ctx, &tok), 0);
+        vec_free(tok.id.str);
+    } while (tok.type != TOKEN_EOF);
+
+    ASSERT_EQ(traced, 7);
+    ASSERT_EQ(ctx.stats.tokens[TOKEN_IDENTIFIER], 3);
+    ASSERT_EQ(ctx.stats.tokens[TOKEN_EQUALS], 1);
+    ASSERT_EQ(ctx.stats.tokens[TOKEN_EOF], 1);
+    ASSERT_EQ(ctx.stats.bytes_identifier, 1 + 6 + 5);
+    ASSERT_EQ(ctx.stats.bytes_punctuator, 3);
+    ASSERT_EQ(ctx.stats.bytes_trivia, strlen(str) - 15);
+    ASSERT_EQ(ctx.stats.escapes, 1);
+    ASSERT_EQ(ctx.stats.slow_paths, 2);
+    ASSERT_GE(ctx.stats.codepoints, 1);
+    ASSERT_GE(ctx.stats.icu_calls, 1);
+    ASSERT_GE(ctx.stats.allocations, 3);
+}
+
+TEST(stats_dump)
+{
+    const char *str = "a;";
+    struct context ctx;
+    struct token tok;
+    char *out = NULL;
+    size_t len;
+    FILE *fp;
+
+    jz_context_init(&ctx, (void *)str, strlen(str));
+    do {
+        ASSERT_EQ(jz_next_token_span(&ctx, &tok), 0);
+    } while (tok.type != TOKEN_EOF);
+
+    ASSERT_NE(fp = open_memstream(&out, &len), NULL);
+    jz_stats_dump(&ctx, fp);
+    fclose(fp);
+
+    ASSERT_EQ(strcmp(out, "{\"tokens\":{\"EOF\":1,\"IDENTIFIER\":1,\"SEMICOLON\":1},"
+        "\"bytes\":{\"trivia\":0,\"identifier\":1,\"punctuator\":1},"
+        "\"codepoints\":0,\"escapes\":0,\"allocations\":0,\"icu_calls\":0,"
+        "\"slow_paths\":0}\n"), 0);
+    free(out);
+}
+
+#endif // JZ_INSTRUMENT
@@ -6,21 +6,17 @@
 
 #include "test.h"
 
-#define ASSERT_TOKEN(str, expected) do {  \
-    struct context ctx;                   \
-    struct token tok;                     \
-    ctx.bytes = (void *)str;              \
-    ctx.size = strlen(str);               \
-    ctx.index = 0;                        \
-    ASSERT_EQ(next_token(&ctx, &tok), 0); \
+#define ASSERT_TOKEN(str, expected) do {             \
+    struct context ctx;                              \
+    struct token tok;                                \
+    jz_context_init(&ctx, (void *)str, strlen(str)); \
+    ASSERT_EQ(next_token(&ctx, &tok), 0);            \
     ASSERT_EQ(tok.type, expected); } while (0)
 
 #define ASSERT_IDENTIFIER(str_, expected) do {              \
     struct context ctx;                                     \
     struct token tok;                                       \
-    ctx.bytes = (void *)str_;                               \
-    ctx.size = strlen(str_);                                \
-    ctx.index = 0;                                          \
+    jz_context_init(&ctx, (void *)str_, strlen(str_));      \
     ASSERT_EQ(next_token(&ctx, &tok), 0);                   \
     ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);                  \
     ASSERT_EQ(memcmp(tok.id.str, expected, tok.id.len), 0); \
@@ -155,4 +151,556 @@ TEST(tokenizer_next_token_identifier)
 
     ASSERT_IDENTIFIER("a\\u0061", "aa");
     ASSERT_IDENTIFIER("a\\u{61}", "aa");
+    ASSERT_IDENTIFIER("a\\u0061b", "aab");
+    ASSERT_IDENTIFIER("caf\xc3\xa9", "caf\xc3\xa9");
+}
+
+TEST(tokenizer_next_token_trivia)
+{
+    const char *str = "  a /* x\n */ // c\r\n\tb\xe2\x80\xa8\xc2\xa0;";
+    struct context ctx;
+    struct token tok;
+
+    jz_context_init(&ctx, (void *)str, strlen(str));
+
+    ASSERT_EQ(next_token(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(tok.trivia, 0);
+    ASSERT_EQ(tok.start, 2);
+    ASSERT_EQ(tok.end, 3);
+    ASSERT_EQ(tok.line, 1);
+    ASSERT_EQ(tok.column, 2);
+    ASSERT_EQ(tok.newline_before, false);
+    vec_free(tok.id.str);
+
+    ASSERT_EQ(next_token(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(tok.trivia, 3);
+    ASSERT_EQ(tok.start, 20);
+    ASSERT_EQ(tok.line, 3);
+    ASSERT_EQ(tok.column, 1);
+    ASSERT_EQ(tok.newline_before, true);
+    vec_free(tok.id.str);
+
+    ASSERT_EQ(next_token(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_SEMICOLON);
+    ASSERT_EQ(tok.line, 4);
+    ASSERT_EQ(tok.column, 2);
+    ASSERT_EQ(tok.newline_before, true);
+
+    ASSERT_EQ(next_token(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_EOF);
+    ASSERT_EQ(tok.start, strlen(str));
+
+    jz_context_init(&ctx, (void *)"/* a", 4);
+    ASSERT_EQ(next_token(&ctx, &tok), -1);
+}
+
+TEST(tokenizer_next_token_span)
+{
+    const char *str = "alpha.\\u0062eta";
+    struct context ctx;
+    struct token tok;
+
+    jz_context_init(&ctx, (void *)str, strlen(str));
+
+    ASSERT_EQ(jz_next_token_span(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(tok.start, 0);
+    ASSERT_EQ(tok.end, 5);
+    ASSERT_EQ(tok.id.str, NULL);
+
+    ASSERT_EQ(jz_next_token_span(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_DOT);
+
+    ASSERT_EQ(jz_next_token_span(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(tok.start, 6);
+    ASSERT_EQ(tok.end, strlen(str));
+    ASSERT_EQ(tok.id.str, NULL);
+
+    jz_context_init(&ctx, (void *)str, strlen(str));
+    ASSERT_EQ(jz_next_token_payload(&ctx, &tok), 0);
+    ASSERT_EQ(memcmp(tok.id.str, "alpha", tok.id.len), 0);
+    vec_free(tok.id.str);
+}
+
+#define ASSERT_SKIP_BALANCED(str, rest) do {         \
+    struct context ctx;                              \
+    jz_context_init(&ctx, (void *)str, strlen(str)); \
+    ASSERT_EQ(jz_skip_balanced(&ctx), 0);            \
+    ASSERT_EQ(strcmp((char *)&ctx.bytes[ctx.index], rest), 0); } while (0)
+
+#define ASSERT_SKIP_BALANCED_FAIL(str) do {          \
+    struct context ctx;                              \
+    jz_context_init(&ctx, (void *)str, strlen(str)); \
+    ASSERT_EQ(jz_skip_balanced(&ctx), -1);           \
+    ASSERT_EQ(ctx.index, 0); } while (0)
+
+TEST(tokenizer_skip_balanced)
+{
+    ASSERT_SKIP_BALANCED("} x", " x");
+    ASSERT_SKIP_BALANCED("a = { b: [1, 2] }; } x", " x");
+    ASSERT_SKIP_BALANCED("if (a) { return; } else { b(); } } x", " x");
+
+    ASSERT_SKIP_BALANCED("s = '}'; t = \"}\\\"\"; } x", " x");
+    ASSERT_SKIP_BALANCED("// }\n} x", " x");
+    ASSERT_SKIP_BALANCED("/* } */ } x", " x");
+
+    ASSERT_SKIP_BALANCED("t = `}${ { a: `}` } }`; } x", " x");
+    ASSERT_SKIP_BALANCED("t = `${`${'}'}`}`; } x", " x");
+
+    ASSERT_SKIP_BALANCED("r = /}[/}]\\//g; } x", " x");
+    ASSERT_SKIP_BALANCED("return /}/; } x", " x");
+    ASSERT_SKIP_BALANCED("a = b / c / d; } x", " x");
+    ASSERT_SKIP_BALANCED("a = (b) / 2 }/ x", "/ x");
+    ASSERT_SKIP_BALANCED("x++ / 2 }rest", "rest");
+    ASSERT_SKIP_BALANCED("a = --b / 2 }rest", "rest");
+    ASSERT_SKIP_BALANCED("x = y + +/}/.source }rest", "rest");
+    ASSERT_SKIP_BALANCED("if (x) /}/.test(y) }rest", "rest");
+    ASSERT_SKIP_BALANCED("while (f(a) / 2) /}/.exec(b); }rest", "rest");
+
+    // Keywords as property names
+    ASSERT_SKIP_BALANCED("x = a.return / 2; y = /}/ } x", " x");
+    ASSERT_SKIP_BALANCED("x = a?.in / y; z = /}/ } x", " x");
+    ASSERT_SKIP_BALANCED("x = obj . delete / z; y = /}/ } x", " x");
+    ASSERT_SKIP_BALANCED("x = a ? .5 : b; return /}/ } x", " x");
+    ASSERT_SKIP_BALANCED("x = of / 2; y = /}/ } x", " x");
+    ASSERT_SKIP_BALANCED("for (x of /}/.exec(y)) {} } x", " x");
+}
+
+TEST(tokenizer_skip_balanced_unterminated)
+{
+    ASSERT_SKIP_BALANCED_FAIL("");
+    ASSERT_SKIP_BALANCED_FAIL("{ }");
+    ASSERT_SKIP_BALANCED_FAIL("'}");
+    ASSERT_SKIP_BALANCED_FAIL("`${ } ");
+    ASSERT_SKIP_BALANCED_FAIL("/* }");
+    ASSERT_SKIP_BALANCED_FAIL("x = /}");
+}
+
+#define ASSERT_PADDED_MATCHES(src) do {                                        \
+    struct context ctx, padded;                                                \
+    struct token tok, tok_padded;                                              \
+    int ret, ret_padded;                                                       \
+    jz_context_init(&ctx, (void *)src, sizeof(src) - 1);                       \
+    ASSERT_EQ(jz_context_init_copy(&padded, (void *)src, sizeof(src) - 1), 0); \
+    do {                                                                       \
+        ret = next_token(&ctx, &tok);                                          \
+        ret_padded = jz_next_token_padded(&padded, &tok_padded);               \
+        ASSERT_EQ(ret_padded, ret);                                            \
+        if (ret < 0)                                                           \
+            break;                                                             \
+        ASSERT_EQ(tok_padded.type, tok.type);                                  \
+        ASSERT_EQ(tok_padded.start, tok.start);                                \
+        ASSERT_EQ(tok_padded.end, tok.end);                                    \
+        ASSERT_EQ(tok_padded.id.len, tok.id.len);                              \
+        if (tok.id.len > 0)                                                    \
+            ASSERT_EQ(memcmp(tok_padded.id.str, tok.id.str, tok.id.len), 0);   \
+        vec_free(tok.id.str);                                                  \
+        vec_free(tok_padded.id.str);                                           \
+    } while (tok.type != TOKEN_EOF);                                           \
+    jz_context_free(&padded); } while (0)
+
+TEST(tokenizer_next_token_padded)
+{
+    ASSERT_PADDED_MATCHES("");
+    ASSERT_PADDED_MATCHES("a");
+    ASSERT_PADDED_MATCHES(">>>");
+    ASSERT_PADDED_MATCHES("a >>>= b ?? c;");
+    ASSERT_PADDED_MATCHES("a_very_long_identifier_name_$0123456789 x");
+    ASSERT_PADDED_MATCHES("abcdefghijklmnop\\u0071rstuvwxyz caf\xc3\xa9s");
+    ASSERT_PADDED_MATCHES("a // comment");
+    ASSERT_PADDED_MATCHES("a /* unterminated");
+    ASSERT_PADDED_MATCHES("a\\u00");
+    ASSERT_PADDED_MATCHES("a\\u{61");
+    ASSERT_PADDED_MATCHES("a\0b");
+}
+
+TEST(tokenizer_next_token_latin1)
+{
+    // "caf\xe9 =\xa0x" with an é and a no-break space, one byte each
+    const uint8_t str[] = { 'c', 'a', 'f', 0xe9, ' ', '=', 0xa0, 'x' };
+    struct context ctx;
+    struct token tok;
+
+    jz_context_init_latin1(&ctx, str, sizeof(str));
+
+    ASSERT_EQ(jz_next_token_latin1(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(tok.start, 0);
+    ASSERT_EQ(tok.end, 4);
+    ASSERT_EQ(tok.id.len, 6);
+    ASSERT_EQ(memcmp(tok.id.str, "caf\xc3\xa9", 6), 0);
+    vec_free(tok.id.str);
+
+    ASSERT_EQ(jz_next_token_latin1(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_EQUALS);
+    ASSERT_EQ(tok.start, 5);
+
+    ASSERT_EQ(jz_next_token_latin1(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(tok.start, 7);
+    ASSERT_EQ(tok.column, 7);
+    vec_free(tok.id.str);
+
+    ASSERT_EQ(jz_next_token_latin1(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_EOF);
+}
+
+TEST(tokenizer_next_token_utf16)
+{
+    // "a >>>= \U0001d400b \\u0063;" with a surrogate pair
+    const uint16_t str[] = {
+        'a', ' ', '>', '>', '>', '=', ' ', 0xd835, 0xdc00, 'b', 0x2028,
+        '\\', 'u', '0', '0', '6', '3', ';',
+    };
+    const size_t len = sizeof(str) / sizeof(*str);
+    struct context ctx;
+    struct token tok;
+
+    jz_context_init_utf16(&ctx, str, len);
+
+    ASSERT_EQ(jz_next_token_utf16(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(tok.end, 1);
+    vec_free(tok.id.str);
+
+    ASSERT_EQ(jz_next_token_utf16(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_GREATER_GREATER_GREATER_EQUALS);
+    ASSERT_EQ(tok.start, 2);
+    ASSERT_EQ(tok.end, 6);
+
+    ASSERT_EQ(jz_next_token_utf16(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(tok.start, 7);
+    ASSERT_EQ(tok.end, 10);
+    ASSERT_EQ(tok.id.len, 6);
+    ASSERT_EQ(memcmp(tok.id.str, "\xf0\x9d\x90\x80" "b", 6), 0);
+    vec_free(tok.id.str);
+
+    ASSERT_EQ(jz_next_token_utf16(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(tok.newline_before, true);
+    ASSERT_EQ(tok.line, 2);
+    ASSERT_EQ(tok.start, 11);
+    ASSERT_EQ(memcmp(tok.id.str, "c", 2), 0);
+    vec_free(tok.id.str);
+
+    ASSERT_EQ(jz_next_token_utf16(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_SEMICOLON);
+
+    ASSERT_EQ(jz_next_token_utf16(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_EOF);
+    ASSERT_EQ(tok.start, len);
+
+    // A lone surrogate is not an identifier
+    const uint16_t lone[] = { 0xd835, 'a' };
+    jz_context_init_utf16(&ctx, lone, 2);
+    ASSERT_EQ(jz_next_token_utf16(&ctx, &tok), -1);
+}
+
+TEST(tokenizer_skip_balanced_utf16)
+{
+    const uint16_t str[] = { 'x', '=', '\'', '}', '\'', ';', '}', ' ' };
+    // U+0172 is not an r, so this is a name and not return
+    const uint16_t name[] = { 0x172, 'e', 't', 'u', 'r', 'n', ' ', '/', ' ', '2', ' ', '}', ' ' };
+    struct context ctx;
+
+    jz_context_init_utf16(&ctx, str, sizeof(str) / sizeof(*str));
+    ASSERT_EQ(jz_skip_balanced(&ctx), 0);
+    ASSERT_EQ(ctx.index, 7);
+
+    jz_context_init_utf16(&ctx, name, sizeof(name) / sizeof(*name));
+    ASSERT_EQ(jz_skip_balanced(&ctx), 0);
+    ASSERT_EQ(ctx.index, 12);
+}
+
+#define ASSERT_RECOVER(ctx, type_, start_, end_) do { \
+    struct token tok;                                  \
+    ASSERT_EQ(jz_next_token_recover(ctx, &tok), 0);    \
+    ASSERT_EQ(tok.type, type_);                        \
+    ASSERT_EQ(tok.start, start_);                      \
+    ASSERT_EQ(tok.end, end_);                          \
+    vec_free(tok.id.str); } while (0)
+
+TEST(tokenizer_next_token_recover)
+{
+    const char *str = "a = 1.5e3 + 'x\\'y' + `t${ {b: `u`} }v` + \\u{110000}c;\n"
+        "@ d /* open";
+    struct context ctx;
+    struct token tok;
+
+    jz_context_init(&ctx, (void *)str, strlen(str));
+    ASSERT_RECOVER(&ctx, TOKEN_IDENTIFIER, 0, 1);
+    ASSERT_RECOVER(&ctx, TOKEN_EQUALS, 2, 3);
+    ASSERT_RECOVER(&ctx, TOKEN_ERROR, 4, 9);
+    ASSERT_RECOVER(&ctx, TOKEN_PLUS, 10, 11);
+    ASSERT_RECOVER(&ctx, TOKEN_ERROR, 12, 18);
+    ASSERT_RECOVER(&ctx, TOKEN_PLUS, 19, 20);
+    ASSERT_RECOVER(&ctx, TOKEN_ERROR, 21, 38);
+    ASSERT_RECOVER(&ctx, TOKEN_PLUS, 39, 40);
+    ASSERT_RECOVER(&ctx, TOKEN_ERROR, 41, 52);
+    ASSERT_RECOVER(&ctx, TOKEN_SEMICOLON, 52, 53);
+    ASSERT_RECOVER(&ctx, TOKEN_ERROR, 54, 55);
+    ASSERT_RECOVER(&ctx, TOKEN_IDENTIFIER, 56, 57);
+
+    ASSERT_EQ(jz_next_token_recover(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_ERROR);
+    ASSERT_EQ(tok.error, JZ_ERROR_UNTERMINATED_COMMENT);
+    ASSERT_EQ(tok.start, 58);
+    ASSERT_EQ(tok.end, strlen(str));
+    ASSERT_EQ(tok.line, 2);
+    ASSERT_EQ(tok.column, 4);
+
+    ASSERT_RECOVER(&ctx, TOKEN_EOF, strlen(str), strlen(str));
+
+    // Every error is recorded once, in order
+    ASSERT_EQ(vec_len(ctx.diagnostics), 6);
+    ASSERT_EQ(ctx.diagnostics[0].error, JZ_ERROR_NUMERIC_LITERAL);
+    ASSERT_EQ(ctx.diagnostics[1].error, JZ_ERROR_STRING_LITERAL);
+    ASSERT_EQ(ctx.diagnostics[2].error, JZ_ERROR_TEMPLATE_LITERAL);
+    ASSERT_EQ(ctx.diagnostics[3].error, JZ_ERROR_INVALID_ESCAPE);
+    ASSERT_EQ(ctx.diagnostics[4].error, JZ_ERROR_INVALID_CHARACTER);
+    ASSERT_EQ(ctx.diagnostics[4].line, 2);
+    ASSERT_EQ(ctx.diagnostics[4].column, 0);
+    ASSERT_EQ(ctx.diagnostics[5].start, 58);
+    jz_context_free(&ctx);
+
+    // Strings end at a line terminator, and the line is still counted
+    str = "'abc\nx";
+    jz_context_init(&ctx, (void *)str, strlen(str));
+    ASSERT_RECOVER(&ctx, TOKEN_ERROR, 0, 4);
+    ASSERT_EQ(jz_next_token_recover(&ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(tok.line, 2);
+    vec_free(tok.id.str);
+    jz_context_free(&ctx);
+
+    // Without recovery the reason is kept on the context
+    jz_context_init(&ctx, (void *)"\\u0000", 6);
+    ASSERT_EQ(next_token(&ctx, &tok), -1);
+    ASSERT_EQ(ctx.error, JZ_ERROR_INVALID_ESCAPE);
+    ASSERT_EQ(ctx.index, 0);
+}
+
+// Tokenizes all of str with JZ_FEATURE_FINGERPRINT, keeping ctx for the
+// statement hashes
+static uint64_t fingerprint(struct context *ctx, const char *str)
+{
+    struct token tok;
+
+    jz_context_init(ctx, (void *)str, strlen(str));
+    ctx->fingerprint.collect_statements = true;
+
+    do {
+        if (jz_next_token_fingerprint(ctx, &tok) < 0)
+            return 0;
+        vec_free(tok.id.str);
+    } while (tok.type != TOKEN_EOF);
+
+    return jz_fingerprint(ctx);
+}
+
+static uint64_t file_fingerprint(const char *str)
+{
+    struct context ctx;
+    uint64_t h;
+
+    h = fingerprint(&ctx, str);
+    jz_context_free(&ctx);
+    return h;
+}
+
+TEST(tokenizer_fingerprint)
+{
+    const uint64_t h = file_fingerprint("a=b;");
+
+    // Formatting, comments and escapes do not matter
+    ASSERT_NE(h, 0);
+    ASSERT_EQ(file_fingerprint("a  =\n  b ; // c\n"), h);
+    ASSERT_EQ(file_fingerprint("/* c */ \\u0061 = b;"), h);
+
+    // Anything else does
+    ASSERT_NE(file_fingerprint("a=c;"), h);
+    ASSERT_NE(file_fingerprint("a=b"), h);
+    ASSERT_NE(file_fingerprint("ab;"), file_fingerprint("a b;"));
+
+    // Error tokens are hashed by their source
+    ASSERT_EQ(file_fingerprint("x = 'a';"), file_fingerprint("x='a';"));
+    ASSERT_NE(file_fingerprint("x = 'a';"), file_fingerprint("x='b';"));
+
+    // Line breaks where automatic semicolon insertion may apply
+    ASSERT_NE(file_fingerprint("function f(){return\nx}"),
+        file_fingerprint("function f(){return x}"));
+    ASSERT_NE(file_fingerprint("a\n++b"), file_fingerprint("a++\nb"));
+    ASSERT_NE(file_fingerprint("a\nb"), file_fingerprint("a b"));
+    ASSERT_EQ(file_fingerprint("a =\nb +\n(c)"), file_fingerprint("a = b + (c)"));
+}
+
+TEST(tokenizer_fingerprint_statements)
+{
+    struct context a, b;
+
+    fingerprint(&a, "function f() { a; }; g(); h");
+    ASSERT_EQ(vec_len(a.fingerprint.statements), 3);
+
+    // Only the statement that changed gets a different hash
+    fingerprint(&b, "function f ( ) {\n  a;\n}\n;\ng(1);\n/* c */ h");
+    ASSERT_EQ(vec_len(b.fingerprint.statements), 3);
+    ASSERT_EQ(a.fingerprint.statements[0], b.fingerprint.statements[0]);
+    ASSERT_NE(a.fingerprint.statements[1], b.fingerprint.statements[1]);
+    ASSERT_EQ(a.fingerprint.statements[2], b.fingerprint.statements[2]);
+    jz_context_free(&b);
+
+    // Statements hash the same wherever they are
+    fingerprint(&b, "h");
+    ASSERT_EQ(vec_len(b.fingerprint.statements), 1);
+    ASSERT_EQ(b.fingerprint.statements[0], a.fingerprint.statements[2]);
+    jz_context_free(&b);
+
+    // Neither does a } closing a nested block, or one followed by else
+    fingerprint(&b, "if (x) { if (y) { z } } else { w } try {} catch {}");
+    ASSERT_EQ(vec_len(b.fingerprint.statements), 2);
+    jz_context_free(&b);
+
+    jz_context_free(&a);
+}
+
+// Tokenizes str with JZ_FEATURE_STATEMENTS and checks the index of the first
+// token of every top-level statement
+#define ASSERT_STATEMENTS(str_, ...) do {                             \
+    const size_t expected[] = { __VA_ARGS__ };                        \
+    const size_t n = sizeof(expected) / sizeof(*expected);            \
+    struct context ctx;                                               \
+    struct token tok;                                                 \
+    jz_context_init(&ctx, (void *)str_, strlen(str_));                \
+    do {                                                              \
+        ASSERT_EQ(jz_next_token_statements(&ctx, &tok), 0);           \
+        vec_free(tok.id.str);                                         \
+    } while (tok.type != TOKEN_EOF);                                  \
+    ASSERT_EQ(vec_len(ctx.statements.starts), n);                     \
+    for (size_t i = 0; i < n; i++)                                    \
+        ASSERT_EQ(ctx.statements.starts[i], expected[i]);             \
+    jz_context_free(&ctx); } while (0)
+
+TEST(tokenizer_statements)
+{
+    ASSERT_STATEMENTS("a; b; c", 0, 2, 4);
+    ASSERT_STATEMENTS("f(a, { b; c }); ; d", 0, 11, 12);
+    ASSERT_STATEMENTS("function f() { a; } g(); class A {} [b]", 0, 8, 12, 16);
+
+    // Blocks of compound statements
+    ASSERT_STATEMENTS("if (a) { b } else { c } d", 0, 11);
+    ASSERT_STATEMENTS("if (a) b; else c; d", 0, 9);
+    ASSERT_STATEMENTS("try {} catch (e) {} finally {} f", 0, 12);
+    ASSERT_STATEMENTS("do { a } while (b) c", 0, 8);
+    ASSERT_STATEMENTS("do a; while (b); c", 0, 8);
+    ASSERT_STATEMENTS("x = function () {} (y) z", 0);
+    ASSERT_STATEMENTS("switch (a) { case b: {} } c", 0, 11);
+
+    // Object literals in the body of compound statements
+    ASSERT_STATEMENTS("if (a) x = {}.y; z;", 0, 11);
+    ASSERT_STATEMENTS("if (a) x = {a:1}[k]; z;", 0, 15);
+    ASSERT_STATEMENTS("while (x) y = {}\n.z", 0);
+    ASSERT_STATEMENTS("if (a) x = {}\nz", 0, 8);
+
+    // Line terminators
+    ASSERT_STATEMENTS("a = b\nc = d\n", 0, 3);
+    ASSERT_STATEMENTS("a = b\n(c)\n[d]\n.e\n+ f", 0);
+    ASSERT_STATEMENTS("a\n++b\nc++\nd", 0, 1, 3, 5);
+    ASSERT_STATEMENTS("x = f()\n'a'\ntag\n`b`", 0, 5, 6);
+    ASSERT_STATEMENTS("if (a)\nb()\nc()", 0, 7);
+    ASSERT_STATEMENTS("for (;;)\nb\nwhile (c)\nd", 0, 6);
+    ASSERT_STATEMENTS("let\nx = a\nin b", 0);
+    ASSERT_STATEMENTS("return\na", 0, 1);
+    ASSERT_STATEMENTS("{ a\nb }\nc", 0, 4);
+}
+
+// Tokenizes the whole input, returning the number of tokens, or 0 if one
+// failed
+static size_t tokenize_all(struct context *ctx)
+{
+    struct token tok;
+    size_t n = 0;
+
+    do {
+        if (jz_next_token_statements(ctx, &tok) < 0)
+            return 0;
+        vec_free(tok.id.str);
+        n++;
+    } while (tok.type != TOKEN_EOF);
+
+    return n;
+}
+
+TEST(tokenizer_context_reset)
+{
+    const char *str = "a; \\u0062 = 'x'; @; lengthy_identifier_name_that_does_not_fit_in_scratch_at_all";
+    const char *other = "c; d";
+    struct context ctx;
+    size_t *starts;
+    struct jz_diagnostic *diagnostics;
+
+    jz_context_init(&ctx, (void *)str, strlen(str));
+    ctx.allocator = &ctx.arena.allocator;
+    ctx.fingerprint.collect_statements = true;
+    ASSERT_EQ(tokenize_all(&ctx), 10);
+    ASSERT_EQ(vec_len(ctx.diagnostics), 2);
+    ASSERT_EQ(vec_len(ctx.statements.starts), 4);
+
+    starts = ctx.statements.starts;
+    diagnostics = ctx.diagnostics;
+    jz_context_reset(&ctx, (void *)other, strlen(other));
+    ASSERT_EQ(ctx.index, 0);
+    ASSERT_EQ(ctx.line, 1);
+    ASSERT_EQ(vec_len(ctx.diagnostics), 0);
+    ASSERT_EQ(vec_len(ctx.statements.starts), 0);
+    ASSERT_EQ(ctx.fingerprint.collect_statements, true);
+
+    ASSERT_EQ(tokenize_all(&ctx), 4);
+    ASSERT_EQ(vec_len(ctx.statements.starts), 2);
+    ASSERT_EQ(ctx.statements.starts[1], 2);
+
+    // Tokenizing the first input again reuses everything
+    jz_context_reset(&ctx, (void *)str, strlen(str));
+    ASSERT_EQ(tokenize_all(&ctx), 10);
+    ASSERT_EQ(ctx.statements.starts, starts);
+    ASSERT_EQ(ctx.diagnostics, diagnostics);
+    ASSERT_EQ(ctx.arena.allocations, 1);
+
+    jz_context_free(&ctx);
+}
+
+TEST(tokenizer_context_pool)
+{
+    const char *str = "import { a } from 'b'; export const c = a + 1;";
+    struct context *ctx, *ctxs[JZ_CONTEXT_POOL + 1];
+    struct token tok;
+
+    ASSERT_NE(ctx = jz_context_acquire((void *)str, strlen(str)), NULL);
+    ASSERT_EQ(jz_next_token_payload(ctx, &tok), 0);
+    ASSERT_EQ(tok.type, TOKEN_IDENTIFIER);
+    ASSERT_EQ(strcmp((char *)tok.id.str, "import"), 0);
+    ctx->encoding = JZ_ENCODING_LATIN1;
+    jz_context_release(ctx);
+
+    // The same context comes back, with its settings cleared
+    for (int file = 0; file < 3; file++) {
+        struct context *next = jz_context_acquire((void *)str, strlen(str));
+
+        ASSERT_EQ(next, ctx);
+        ASSERT_EQ(next->encoding, JZ_ENCODING_UTF8);
+        ASSERT_EQ(tokenize_all(next), 16);
+        ASSERT_EQ(next->arena.allocations, 1);
+        jz_context_release(next);
+    }
+
+    // Past the size of the pool, contexts are freed
+    for (int i = 0; i < JZ_CONTEXT_POOL + 1; i++)
+        ASSERT_NE(ctxs[i] = jz_context_acquire((void *)str, strlen(str)), NULL);
+    for (int i = 0; i < JZ_CONTEXT_POOL + 1; i++)
+        jz_context_release(ctxs[i]);
+    jz_context_pool_clear();
+    jz_context_release(NULL);
 }
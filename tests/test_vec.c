@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <vec.h>
+
+#include "test.h"
+
+struct counting_allocator
+{
+    size_t allocs;
+    size_t frees;
+    size_t limit;
+};
+
+static void *counting_realloc(void *data, void *ptr, size_t old_size, size_t new_size)
+{
+    struct counting_allocator *a = data;
+
+    (void)old_size;
+    if (new_size > a->limit)
+        return NULL;
+    a->allocs++;
+    return realloc(ptr, new_size);
+}
+
+static void counting_free(void *data, void *ptr)
+{
+    struct counting_allocator *a = data;
+
+    a->frees++;
+    free(ptr);
+}
+
+TEST(vec_push)
+{
+    int *v = NULL;
+
+    ASSERT_EQ(vec_empty(v), 1);
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(*vec_push(v, i), i);
+
+    ASSERT_EQ(vec_len(v), 100);
+    ASSERT_GE(vec_cap(v), 100);
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(v[i], i);
+
+    vec_clear(v);
+    ASSERT_EQ(vec_len(v), 0);
+    vec_free(v);
+}
+
+TEST(vec_reserve_resize)
+{
+    uint8_t *v = NULL;
+
+    ASSERT_EQ(vec_reserve(v, 13), 0);
+    ASSERT_EQ(vec_cap(v), 13);
+    ASSERT_EQ(vec_len(v), 0);
+
+    // Reserving less is a no-op
+    ASSERT_EQ(vec_reserve(v, 5), 0);
+    ASSERT_EQ(vec_cap(v), 13);
+
+    ASSERT_EQ(vec_resize(v, 20), 0);
+    ASSERT_EQ(vec_len(v), 20);
+    ASSERT_GE(vec_cap(v), 20);
+
+    ASSERT_EQ(vec_resize(v, 3), 0);
+    ASSERT_EQ(vec_len(v), 3);
+    vec_free(v);
+}
+
+TEST(vec_inline)
+{
+    vec_inline(uint8_t, 4) storage;
+    uint8_t *v;
+
+    vec_init_inline(v, storage);
+    ASSERT_EQ(vec_cap(v), 4);
+    for (int i = 0; i < 4; i++)
+        vec_push(v, 'a' + i);
+    ASSERT_EQ(v, storage.items);
+
+    // Moves to allocated storage, keeping the contents
+    vec_push(v, 'e');
+    ASSERT_NE(v, storage.items);
+    ASSERT_EQ(vec_len(v), 5);
+    ASSERT_EQ(memcmp(v, "abcde", 5), 0);
+    vec_free(v);
+
+    // Freeing inline storage is a no-op
+    vec_init_inline(v, storage);
+    vec_free(v);
+}
+
+TEST(vec_allocator)
+{
+    struct counting_allocator a = { .limit = 1 << 20 };
+    struct vec_allocator allocator = { counting_realloc, counting_free, &a };
+    int *v;
+
+    vec_new(v, &allocator, 4);
+    ASSERT_NE(v, NULL);
+    for (int i = 0; i < 64; i++)
+        vec_push(v, i);
+    ASSERT_EQ(v[63], 63);
+    ASSERT_GT(a.allocs, 1);
+
+    vec_free(v);
+    ASSERT_EQ(a.frees, 1);
+}
+
+TEST(vec_allocation_failure)
+{
+    struct counting_allocator a = { .limit = 128 };
+    struct vec_allocator allocator = { counting_realloc, counting_free, &a };
+    uint8_t *v;
+    uint8_t *prev;
+
+    vec_new(v, &allocator, 8);
+    ASSERT_NE(v, NULL);
+    while (vec_push(v, 1))
+        ;
+
+    // The failed push left the vector intact
+    prev = v;
+    ASSERT_EQ(vec_push(v, 2), NULL);
+    ASSERT_EQ(v, prev);
+    ASSERT_GT(vec_len(v), 8);
+    ASSERT_EQ(v[vec_len(v) - 1], 1);
+    ASSERT_EQ(vec_reserve(v, 1 << 20), -1);
+    ASSERT_EQ(vec_resize(v, 1 << 20), -1);
+    ASSERT_EQ(v, prev);
+
+    vec_free(v);
+
+    vec_new(v, &allocator, 1 << 20);
+    ASSERT_EQ(v, NULL);
+
+    // Past the largest length a header can hold
+    vec_new(v, &allocator, 8);
+    prev = v;
+    ASSERT_EQ(vec_reserve(v, (size_t)1 << 31), -1);
+    ASSERT_EQ(v, prev);
+    vec_free(v);
+}
+
+TEST(vec_header_size)
+{
+    ASSERT_EQ(sizeof(struct vec_header), 16);
+}
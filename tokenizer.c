@@ -3,44 +3,81 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <unicode/uchar.h>
 
 #include "token.h"
 #include "tokenizer.h"
 #include "vec.h"
 
-static const char *token_strings[] = {
-#define F(x) #x,
-    TOKEN_LIST(F)
-#undef F
-};
+#ifdef JZ_INSTRUMENT
+_Thread_local size_t vec_allocations_;
+static _Thread_local size_t icu_calls_;
+
+#define STAT(ctx, field, n) ((ctx)->stats.field += (n))
+#define ICU(call) (icu_calls_++, (call))
+#else
+#define STAT(ctx, field, n) ((void)0)
+#define ICU(call) (call)
+#endif
+
+// Code unit at index i, a byte for UTF-8 and Latin-1 input
+static inline __attribute__((always_inline))
+uint32_t unit_at(const struct context *ctx, const size_t i, const unsigned features)
+{
+    if (features & JZ_FEATURE_UTF16)
+        return ctx->units[i];
+    return ctx->bytes[i];
+}
 
-static uint32_t peek_offset(struct context *ctx, const size_t offset)
+// With JZ_FEATURE_SENTINEL, the input is followed by JZ_PADDING zero bytes,
+// so reading past the end gives 0 instead of -1 and needs no bounds check.
+// Nothing accepts a 0, so scanning stops there on its own.
+static inline __attribute__((always_inline))
+uint32_t peek_offset(struct context *ctx, const size_t offset, const unsigned features)
 {
     assert(ctx && ctx->bytes);
 
+    if (features & JZ_FEATURE_SENTINEL)
+        return unit_at(ctx, ctx->index + offset, features);
+
     if (ctx->index + offset >= ctx->size)
         return -1;
-    return ctx->bytes[ctx->index + offset];
+    return unit_at(ctx, ctx->index + offset, features);
 }
 
-static uint32_t peek(struct context *ctx)
+static inline __attribute__((always_inline))
+uint32_t peek(struct context *ctx, const unsigned features)
 {
-    return peek_offset(ctx, 0);
+    return peek_offset(ctx, 0, features);
 }
 
-static uint32_t read(struct context *ctx)
+static inline __attribute__((always_inline))
+uint32_t read(struct context *ctx, const unsigned features)
 {
     uint32_t c;
-    if ((c = peek(ctx)) == (uint32_t)-1)
+    if ((c = peek(ctx, features)) == (uint32_t)-1)
         return -1;
     ctx->index++;
     return c;
 }
 
-static uint32_t utf8_to_codepoint(const uint8_t *bytes, int *size)
+// Whether c, as returned by peek, marks the end of the input
+static inline __attribute__((always_inline))
+bool is_end(struct context *ctx, const uint32_t c, const unsigned features)
+{
+    if (features & JZ_FEATURE_SENTINEL)
+        return c == 0 && ctx->index >= ctx->size;
+    return c == (uint32_t)-1;
+}
+
+static uint32_t utf8_to_codepoint(const uint8_t *bytes, const size_t avail, int *size)
 {
     int retval;
 
@@ -55,7 +92,7 @@ static uint32_t utf8_to_codepoint(const uint8_t *bytes, int *size)
     }
 
     // 110xx xxx 10xx xxxx
-    if (A(0, 0xe0, 0xc0) && A(1, 0xc0, 0x80)) {
+    if (avail >= 2 && A(0, 0xe0, 0xc0) && A(1, 0xc0, 0x80)) {
         retval = B(0, 0x1f, 6) | B(1, 0x3f, 0);
         if (retval < 0x80)
             return -1;
@@ -65,7 +102,7 @@ static uint32_t utf8_to_codepoint(const uint8_t *bytes, int *size)
     }
 
     // 1110 xxxx 10xx xxxx 10xx xxxx
-    if (A(0, 0xf0, 0xe0) && A(1, 0xc0, 0x80) && A(2, 0xc0, 0x80)) {
+    if (avail >= 3 && A(0, 0xf0, 0xe0) && A(1, 0xc0, 0x80) && A(2, 0xc0, 0x80)) {
         retval = B(0, 0xf, 12) | B(1, 0x3f, 6) | B(2, 0x3f, 0);
         if (retval < 0x800 || (retval >= 0xd800 && retval <= 0xdfff))
             return -1;
@@ -75,7 +112,7 @@ static uint32_t utf8_to_codepoint(const uint8_t *bytes, int *size)
     }
 
     // 1111 0xxx 10xx xxxx 10xx xxxx 10xx xxxx
-    if (A(0, 0xf8, 0xf0) && A(1, 0xc0, 0x80) && A(2, 0xc0, 0x80)  && A(3, 0xc0, 0x80)) {
+    if (avail >= 4 && A(0, 0xf8, 0xf0) && A(1, 0xc0, 0x80) && A(2, 0xc0, 0x80)  && A(3, 0xc0, 0x80)) {
         retval = B(0, 0x7, 18) | B(1, 0x3f, 12) | B(2, 0x3f, 6) | B(3, 0x3f, 0);
         if (retval < 0x10000 || retval > 0x10ffff)
             return -1;
@@ -90,34 +127,39 @@ static uint32_t utf8_to_codepoint(const uint8_t *bytes, int *size)
     return -1;
 }
 
-__attribute__((unused))
-static uint32_t peek_codepoint(struct context *ctx)
+static inline __attribute__((always_inline))
+uint32_t peek_codepoint(struct context *ctx, int *size, const unsigned features)
 {
-    uint32_t c;
-
     // Character is ASCII
-    if (peek(ctx) < 0x80)
-        return peek(ctx);
+    if (peek(ctx, features) < 0x80) {
+        *size = 1;
+        return peek(ctx, features);
+    }
 
-    if ((c = utf8_to_codepoint(ctx->bytes, NULL)))
+    if (ctx->index >= ctx->size)
         return -1;
-    return c;
-}
+    STAT(ctx, codepoints, 1);
 
-__attribute__((unused))
-static uint32_t read_codepoint(struct context *ctx)
-{
-    uint32_t c;
-    int size;
+    // Every code unit is a code point
+    if (features & JZ_FEATURE_LATIN1) {
+        *size = 1;
+        return ctx->bytes[ctx->index];
+    }
 
-    // Character is ASCII
-    if (peek(ctx) < 0x80)
-        return read(ctx);
+    // Lone surrogates are returned as is, and nothing accepts them
+    if (features & JZ_FEATURE_UTF16) {
+        const uint32_t hi = ctx->units[ctx->index];
+        const uint32_t lo = ctx->index + 1 < ctx->size ? ctx->units[ctx->index + 1] : 0;
 
-    if ((c = utf8_to_codepoint(ctx->bytes, &size)))
-        return -1;
-    ctx->index += size;
-    return c;
+        if (hi >= 0xd800 && hi <= 0xdbff && lo >= 0xdc00 && lo <= 0xdfff) {
+            *size = 2;
+            return 0x10000 + ((hi - 0xd800) << 10) + (lo - 0xdc00);
+        }
+        *size = 1;
+        return hi;
+    }
+
+    return utf8_to_codepoint(&ctx->bytes[ctx->index], ctx->size - ctx->index, size);
 }
 
 // https://tc39.es/ecma262/#prod-WhiteSpace
@@ -128,14 +170,29 @@ static uint32_t read_codepoint(struct context *ctx)
 //     <FF>                 ; Form feed
 //     <ZWNBSP>             ; Zero width no-break space
 //     <USP>                ; Any code point in general category "Space_Separator"
-__attribute__((unused))
-static bool is_whitespace(const int cp)
+static bool is_whitespace(const uint32_t cp)
 {
     return cp == '\t'
         || cp == '\v'
         || cp == '\f'
+        || cp == ' '
         || cp == 0xfeff
-        || u_isUWhiteSpace(cp);
+        || (cp >= 0x80 && ICU(u_charType(cp)) == U_SPACE_SEPARATOR);
+}
+
+// https://tc39.es/ecma262/#prod-LineTerminator
+//
+//   LineTerminator ::
+//     <LF>                 ; Line feed
+//     <CR>                 ; Carriage return
+//     <LS>                 ; Line separator
+//     <PS>                 ; Paragraph separator
+static bool is_line_terminator(const uint32_t cp)
+{
+    return cp == '\n'
+        || cp == '\r'
+        || cp == 0x2028
+        || cp == 0x2029;
 }
 
 // https://tc39.es/ecma262/#prod-IdentifierStart
@@ -146,9 +203,14 @@ static bool is_whitespace(const int cp)
 //     _
 static bool is_identifier_start(const uint32_t cp)
 {
-    return cp == '$'
-        || cp == '_'
-        || u_isIDStart(cp);
+    if (cp < 0x80) {
+        return (cp >= 'a' && cp <= 'z')
+            || (cp >= 'A' && cp <= 'Z')
+            || cp == '$'
+            || cp == '_';
+    }
+
+    return ICU(u_isIDStart(cp));
 }
 
 // https://tc39.es/ecma262/#prod-IdentifierPart
@@ -158,28 +220,44 @@ static bool is_identifier_start(const uint32_t cp)
 //     $
 static bool is_identifier_part(const uint32_t cp)
 {
-    return cp == '$'
-        || u_isIDPart(cp);
+    if (cp < 0x80) {
+        return (cp >= 'a' && cp <= 'z')
+            || (cp >= 'A' && cp <= 'Z')
+            || (cp >= '0' && cp <= '9')
+            || cp == '$'
+            || cp == '_';
+    }
+
+    return ICU(u_isIDPart(cp));
 }
 
-// TODO: Return a status code
-static void push_codepoint(uint8_t **buf, uint32_t cp)
+static int push_codepoint(uint8_t **buf, uint32_t cp)
 {
+    uint8_t bytes[4];
+    int len = 0;
+
     if (cp <= 0x7f) {
-        vec_push(*buf, cp);
+        bytes[len++] = cp;
     } else if (cp <= 0x7ff) {
-        vec_push(*buf, ((cp >> 6) & 0x1f) | 0xc0);
-        vec_push(*buf, (cp        & 0x3f) | 0x80);
+        bytes[len++] = ((cp >> 6) & 0x1f) | 0xc0;
+        bytes[len++] = (cp        & 0x3f) | 0x80;
     } else if (cp <= 0xffff) {
-        vec_push(*buf, ((cp >> 12) & 0x0f) | 0xe0);
-        vec_push(*buf, ((cp >> 6)  & 0x3f) | 0x80);
-        vec_push(*buf, (cp         & 0x3f) | 0x80);
+        bytes[len++] = ((cp >> 12) & 0x0f) | 0xe0;
+        bytes[len++] = ((cp >> 6)  & 0x3f) | 0x80;
+        bytes[len++] = (cp         & 0x3f) | 0x80;
     } else if (cp <= 0x10ffff) {
-        vec_push(*buf, ((cp >> 18) & 0x07) | 0xf0);
-        vec_push(*buf, ((cp >> 12) & 0x3f) | 0x80);
-        vec_push(*buf, ((cp >> 6)  & 0x3f) | 0x80);
-        vec_push(*buf, (cp         & 0x3f) | 0x80);
+        bytes[len++] = ((cp >> 18) & 0x07) | 0xf0;
+        bytes[len++] = ((cp >> 12) & 0x3f) | 0x80;
+        bytes[len++] = ((cp >> 6)  & 0x3f) | 0x80;
+        bytes[len++] = (cp         & 0x3f) | 0x80;
     }
+
+    for (int i = 0; i < len; i++) {
+        if (!vec_push(*buf, bytes[i]))
+            return -1;
+    }
+
+    return 0;
 }
 
 bool ishex(const uint32_t c)
@@ -220,48 +298,48 @@ uint32_t hextoi(const uint32_t c)
 //
 //   CodePoint ::
 //     HexDigits                ; but only if the MV of HexDigits <= 0x10ffff
-static uint32_t read_escape_sequence(struct context *ctx)
+static inline __attribute__((always_inline))
+uint32_t read_escape_sequence(struct context *ctx, const unsigned features)
 {
     static const uint32_t powers[] = {65536, 4096, 256, 16, 1};
     size_t cnt;
     uint32_t cp;
 
-    if (read(ctx) != 'u')
+    STAT(ctx, escapes, 1);
+    if (read(ctx, features) != 'u')
         return -1;
 
-    if (peek(ctx) == '{') {
-        read(ctx);
+    if (peek(ctx, features) == '{') {
+        read(ctx, features);
 
         // Skip any leading zeroes
-        while (peek(ctx) == '0')
-            read(ctx);
+        while (peek(ctx, features) == '0')
+            read(ctx, features);
 
         cnt = 0;
-        while (ishex(peek_offset(ctx, cnt)))
+        while (ishex(peek_offset(ctx, cnt, features)))
             cnt++;
 
         // Count can only be between one and six
-        if (cnt == 0 || cnt > 6 || peek_offset(ctx, cnt) != '}')
+        if (cnt == 0 || cnt > 6 || peek_offset(ctx, cnt, features) != '}')
             return -1;
 
         cp = 0;
         if (cnt == 6) {
             cp = 1048576; // 1 * 16 ^ 5
-            read(ctx);
+            read(ctx, features);
             cnt--;
         }
 
-        for (size_t i = 0; i < cnt; i++) {
-            // printf("%c\n", peek(ctx));
-            cp += hextoi(read(ctx)) * powers[5 - cnt + i];
-        }
-        read(ctx);
+        for (size_t i = 0; i < cnt; i++)
+            cp += hextoi(read(ctx, features)) * powers[5 - cnt + i];
+        read(ctx, features);
     } else {
         cp = 0;
         for (size_t i = 0; i < 4; i++) {
-            if (!ishex(peek(ctx)))
+            if (!ishex(peek(ctx, features)))
                 return -1;
-            cp += hextoi(read(ctx)) * powers[1 + i];
+            cp += hextoi(read(ctx, features)) * powers[1 + i];
         }
     }
 
@@ -270,6 +348,62 @@ static uint32_t read_escape_sequence(struct context *ctx)
     return cp;
 }
 
+// Length of the run of ASCII identifier characters at bytes. Reads ahead 16
+// bytes at a time, so the input must be padded.
+static size_t ascii_identifier_run(const uint8_t *bytes)
+{
+    size_t n = 0;
+
+#ifdef __SSE2__
+    for (;; n += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)&bytes[n]);
+        const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+        // Bytes >= 0x80 are negative, and fail every range check
+        const __m128i alpha = _mm_and_si128(
+            _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+            _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        const __m128i digit = _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+            _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        const __m128i other = _mm_or_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('$')),
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+
+        const unsigned mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(alpha, digit), other));
+        if (mask != 0xffff)
+            return n + __builtin_ctz(~mask);
+    }
+#else
+    while (bytes[n] < 0x80 && is_identifier_part(bytes[n]))
+        n++;
+    return n;
+#endif
+}
+
+// Like ascii_identifier_run, but stops at size for unpadded input
+static size_t ascii_identifier_run_bounded(const uint8_t *bytes, const size_t size)
+{
+    size_t n = 0;
+
+    while (n < size && bytes[n] < 0x80 && is_identifier_part(bytes[n]))
+        n++;
+    return n;
+}
+
+// Code units that may be part of an identifier, keyword or numeric literal
+static bool is_word_unit(const uint32_t c)
+{
+    return (c >= 'a' && c <= 'z')
+        || (c >= 'A' && c <= 'Z')
+        || (c >= '0' && c <= '9')
+        || c == '$'
+        || c == '_'
+        || c == '\\'
+        || c >= 0x80;
+}
+
 // https://tc39.es/ecma262/#prod-IdentifierName
 //
 //   PrivateIdentifier ::
@@ -278,80 +412,283 @@ static uint32_t read_escape_sequence(struct context *ctx)
 //   IdentifierName ::
 //     IdentifierStart
 //     IdentifierName IdentifierPart
-static int read_identifier_name(struct context *ctx, struct token *tok)
+static inline __attribute__((always_inline))
+int read_identifier_name(struct context *ctx, struct token *tok, const unsigned features)
 {
+    // Most names fit here, and are copied out with a single allocation from
+    // ctx->allocator
+    vec_inline(uint8_t, 64) scratch;
     uint8_t *buf = NULL;
+    uint8_t *str = NULL;
+    const size_t start = ctx->index;
+    enum jz_error error = JZ_ERROR_OUT_OF_MEMORY;
     uint32_t cp;
+    int size;
 
-    // Include # for private identifiers
-    if (peek(ctx) == '#')
-        vec_push(buf, read(ctx));
+    if (features & JZ_FEATURE_PAYLOAD)
+        vec_init_inline_from(buf, ctx->allocator, scratch);
 
-    if (peek(ctx) == '\\') {
-        read(ctx);
-        if ((cp = read_escape_sequence(ctx)) == (uint32_t)-1)
-            return -1;
-    } else {
-        cp = read_codepoint(ctx);
+    // Include # for private identifiers
+    if (peek(ctx, features) == '#') {
+        read(ctx, features);
+        if (features & JZ_FEATURE_PAYLOAD)
+            vec_push(buf, '#');
     }
 
-    if (!is_identifier_start(cp))
-        return -1;
-    push_codepoint(&buf, cp);
+    for (bool first = true;; first = false) {
+        // Copy runs of ASCII at once rather than a code point at a time
+        if (!(features & JZ_FEATURE_UTF16) && !first) {
+            const size_t run = features & JZ_FEATURE_SENTINEL
+                ? ascii_identifier_run(&ctx->bytes[ctx->index])
+                : ascii_identifier_run_bounded(&ctx->bytes[ctx->index], ctx->size - ctx->index);
+            if ((features & JZ_FEATURE_PAYLOAD)
+                && vec_append(buf, &ctx->bytes[ctx->index], run) < 0)
+                goto fail;
+            ctx->index += run;
+        }
 
-    for (;;) {
-        if (peek(ctx) == '\\') {
-            read(ctx);
-            if ((cp = read_escape_sequence(ctx)) == (uint32_t)-1)
-                return -1;
+        if (peek(ctx, features) == '\\') {
+            STAT(ctx, slow_paths, 1);
+            read(ctx, features);
+            error = JZ_ERROR_INVALID_ESCAPE;
+            if ((cp = read_escape_sequence(ctx, features)) == (uint32_t)-1)
+                goto fail;
+
+            // Escaped code points must be valid as well
+            if (first ? !is_identifier_start(cp) : !is_identifier_part(cp))
+                goto fail;
+            error = JZ_ERROR_OUT_OF_MEMORY;
+            size = 0;
         } else {
-            cp = peek_codepoint(ctx);
+            cp = peek_codepoint(ctx, &size, features);
+            if (cp == (uint32_t)-1
+                || (first ? !is_identifier_start(cp) : !is_identifier_part(cp))) {
+                if (first) {
+                    error = JZ_ERROR_INVALID_CHARACTER;
+                    goto fail;
+                }
+                break;
+            }
+            if (size > 1)
+                STAT(ctx, slow_paths, 1);
         }
 
-        if (!is_identifier_part(cp))
-            break;
+        if ((features & JZ_FEATURE_PAYLOAD) && push_codepoint(&buf, cp) < 0)
+            goto fail;
+        ctx->index += size;
+    }
+
+    if (features & JZ_FEATURE_PAYLOAD) {
+        if (!vec_push(buf, 0))
+            goto fail;
 
-        push_codepoint(&buf, cp);
-        read_codepoint(ctx);
+        if (vec_header_(buf)->inline_) {
+            if (!vec_new(str, ctx->allocator, vec_len(buf))
+                || vec_append(str, buf, vec_len(buf)) < 0)
+                goto fail;
+            buf = str;
+        }
+
+        tok->id.str = buf;
+        tok->id.len = vec_len(buf);
     }
 
-    vec_push(buf, 0);
     tok->type = TOKEN_IDENTIFIER;
-    tok->id.str = buf;
-    tok->id.len = vec_len(buf);
 
     return 0;
+
+fail:
+    vec_free(buf);
+    ctx->index = start;
+    ctx->error = error;
+    return -1;
 }
 
-int next_token(struct context *ctx, struct token *tok)
+static inline __attribute__((always_inline))
+void newline(struct context *ctx, const unsigned features)
 {
-    assert(ctx && ctx->bytes);
+    if (features & JZ_FEATURE_POSITION) {
+        ctx->line++;
+        ctx->line_start = ctx->index;
+    }
+}
+
+// https://tc39.es/ecma262/#sec-comments
+//
+//   Comment ::
+//     MultiLineComment
+//     SingleLineComment
+//
+// Skips whitespace, line terminators and comments before a token
+static inline __attribute__((always_inline))
+int skip_trivia(struct context *ctx, struct token *tok, const unsigned features)
+{
+    bool newline_before = false;
+    size_t comment, line, line_start;
+    uint32_t c, cp;
+    int size;
+
+    if (features & JZ_FEATURE_TRIVIA)
+        tok->trivia = ctx->index;
+
+    for (;;) {
+        switch ((c = peek(ctx, features))) {
+        case ' ':
+        case '\t':
+        case '\v':
+        case '\f':
+            ctx->index++;
+            continue;
+
+        case '\r':
+            // CR LF is a single line terminator
+            if (peek_offset(ctx, 1, features) == '\n')
+                ctx->index++;
+            // fallthrough
+        case '\n':
+            ctx->index++;
+            newline(ctx, features);
+            newline_before = true;
+            continue;
+
+        case '/':
+            if (peek_offset(ctx, 1, features) == '/') {
+                ctx->index += 2;
+                while (!is_end(ctx, (c = peek(ctx, features)), features)) {
+                    if (c == '\n' || c == '\r')
+                        break;
+                    if (c >= 0x80 && is_line_terminator(peek_codepoint(ctx, &size, features)))
+                        break;
+                    ctx->index++;
+                }
+                continue;
+            }
+
+            if (peek_offset(ctx, 1, features) == '*') {
+                comment = ctx->index;
+                line = ctx->line;
+                line_start = ctx->line_start;
+                ctx->index += 2;
+                for (;;) {
+                    if (is_end(ctx, (c = peek(ctx, features)), features))
+                        goto unterminated;
+                    if (c == '*' && peek_offset(ctx, 1, features) == '/')
+                        break;
+
+                    // CR LF is a single line terminator
+                    if (c == '\n' || (c == '\r' && peek_offset(ctx, 1, features) != '\n')) {
+                        ctx->index++;
+                        newline(ctx, features);
+                        newline_before = true;
+                        continue;
+                    }
+
+                    if (c < 0x80 || (cp = peek_codepoint(ctx, &size, features)) == (uint32_t)-1) {
+                        ctx->index++;
+                        continue;
+                    }
+
+                    ctx->index += size;
+                    if (is_line_terminator(cp)) {
+                        newline(ctx, features);
+                        newline_before = true;
+                    }
+                }
+                ctx->index += 2;
+                continue;
+            }
+            break;
+
+        default:
+            if (c < 0x80 || (cp = peek_codepoint(ctx, &size, features)) == (uint32_t)-1)
+                break;
+
+            STAT(ctx, slow_paths, 1);
+            if (is_line_terminator(cp)) {
+                ctx->index += size;
+                newline(ctx, features);
+                newline_before = true;
+                continue;
+            }
+            if (is_whitespace(cp)) {
+                ctx->index += size;
+                continue;
+            }
+            break;
+        }
+
+        break;
+    }
+
+    if (features & JZ_FEATURE_TRIVIA)
+        tok->newline_before = newline_before;
+
+    return 0;
+
+unterminated:
+    // Leave the comment where it started for the caller to report
+    ctx->index = comment;
+    if (features & JZ_FEATURE_POSITION) {
+        ctx->line = line;
+        ctx->line_start = line_start;
+    }
+    ctx->error = JZ_ERROR_UNTERMINATED_COMMENT;
+
+    if (features & JZ_FEATURE_TRIVIA)
+        tok->newline_before = newline_before;
+
+    return -1;
+}
+
+// Whether the input continues with the ASCII string s
+static inline __attribute__((always_inline))
+bool match_ascii(struct context *ctx, const char *s, const size_t len, const unsigned features)
+{
+    if (!(features & JZ_FEATURE_SENTINEL) && ctx->index + len > ctx->size)
+        return false;
+
+    if (features & JZ_FEATURE_UTF16) {
+        for (size_t i = 0; i < len; i++) {
+            if (ctx->units[ctx->index + i] != (uint8_t)s[i])
+                return false;
+        }
+        return true;
+    }
 
-    if (ctx->index >= ctx->size) {
+    return memcmp(&ctx->bytes[ctx->index], s, len) == 0;
+}
+
+static inline __attribute__((always_inline))
+int scan_token(struct context *ctx, struct token *tok, const unsigned features)
+{
+    if (is_end(ctx, peek(ctx, features), features)) {
         tok->type = TOKEN_EOF;
         return 0;
     }
 
-    switch (peek(ctx)) {
+    switch (peek(ctx, features)) {
     case -1:
         tok->type = TOKEN_EOF;
         return 0;
 
     case '0' ... '9':
         // TODO: Implement parse_numeric_literal
+        ctx->error = JZ_ERROR_NUMERIC_LITERAL;
         return -1;
 
     case '"':
     case '\'':
         // TODO: Implement parse_string_literal
+        ctx->error = JZ_ERROR_STRING_LITERAL;
         return -1;
 
     case '`':
         // TODO: Implement parse_template_literal
+        ctx->error = JZ_ERROR_TEMPLATE_LITERAL;
         return -1;
 
     default:
-        return read_identifier_name(ctx, tok);
+        return read_identifier_name(ctx, tok, features);
 
 #define F(c, type_)        \
     case c:                \
@@ -372,11 +709,10 @@ int next_token(struct context *ctx, struct token *tok)
 
 #undef F
 
-#define F(s, type_)                                              \
-    if (ctx->index + strlen(s) <= ctx->size                      \
-        && memcmp(&ctx->bytes[ctx->index], s, strlen(s)) == 0) { \
-        tok->type = type_;                                       \
-        ctx->index += strlen(s);                                 \
+#define F(s, type_)                             \
+    if (match_ascii(ctx, s, strlen(s), features)) { \
+        tok->type = type_;                          \
+        ctx->index += strlen(s);                    \
         return 0; }
 
     // &&= && &= &
@@ -503,15 +839,1003 @@ int next_token(struct context *ctx, struct token *tok)
     return 0;
 }
 
-void print_token(struct token *tok)
+// Maximum nesting depth of template substitutions tracked by jz_skip_balanced
+#define SKIP_TEMPLATE_DEPTH 64
+
+// Maximum nesting depth of parentheses whose kind jz_skip_balanced tracks.
+// Deeper ones are taken to be expressions.
+#define SKIP_PAREN_DEPTH 64
+
+#define B(i) unit_at(ctx, (i), features)
+
+// Keywords after which a '/' starts a regular expression instead of a division
+static inline __attribute__((always_inline))
+bool is_expression_keyword(const struct context *ctx, const size_t start,
+    const size_t len, const unsigned features)
+{
+    char s[16];
+
+    if (len >= sizeof(s))
+        return false;
+    // Wider units are not narrowed, so they cannot pass for ASCII letters
+    for (size_t i = 0; i < len; i++) {
+        const uint32_t c = unit_at(ctx, start + i, features);
+        if (c >= 0x80)
+            return false;
+        s[i] = c;
+    }
+
+#define K(kw) (len == sizeof(kw) - 1 && memcmp(s, kw, len) == 0)
+    return K("return") || K("typeof") || K("instanceof") || K("in")
+        || K("new") || K("delete") || K("void") || K("throw")
+        || K("case") || K("do") || K("else") || K("yield") || K("await");
+#undef K
+}
+
+// Keywords whose parenthesized head is followed by a statement, so a '/'
+// after its ) starts a regular expression
+static inline __attribute__((always_inline))
+bool is_condition_keyword(const struct context *ctx, const size_t start,
+    const size_t len, const unsigned features)
+{
+    char s[8];
+
+    if (len >= sizeof(s))
+        return false;
+    // Wider units are not narrowed, so they cannot pass for ASCII letters
+    for (size_t i = 0; i < len; i++) {
+        const uint32_t c = unit_at(ctx, start + i, features);
+        if (c >= 0x80)
+            return false;
+        s[i] = c;
+    }
+
+#define K(kw) (len == sizeof(kw) - 1 && memcmp(s, kw, len) == 0)
+    return K("if") || K("while") || K("for") || K("with");
+#undef K
+}
+
+// Scans the rest of a template literal, starting after ` or after the } of a
+// substitution. Returns 0 if the template ended, 1 if a substitution ${ was
+// entered, and -1 if the input ended first.
+static inline __attribute__((always_inline))
+int skip_template(const struct context *ctx, size_t *i, const unsigned features)
+{
+    const size_t n = ctx->size;
+
+    for (size_t j = *i; j < n; j++) {
+        switch (B(j)) {
+        case '\\':
+            j++;
+            break;
+
+        case '`':
+            *i = j + 1;
+            return 0;
+
+        case '$':
+            if (j + 1 < n && B(j + 1) == '{') {
+                *i = j + 2;
+                return 1;
+            }
+            break;
+        }
+    }
+
+    return -1;
+}
+
+static inline __attribute__((always_inline))
+int skip_balanced(struct context *ctx, const unsigned features)
+{
+    const size_t n = ctx->size;
+    size_t i = ctx->index;
+
+    // Brace depth at which each open template substitution started
+    size_t templates[SKIP_TEMPLATE_DEPTH];
+    size_t ntemplates = 0;
+    size_t depth = 0;
+
+    // Bit per open parenthesis, set if it is the head of an if, while, for
+    // or with, as those are followed by a statement instead of an operator
+    uint64_t heads = 0;
+    size_t parens = 0;
+    bool condition = false;
+
+    // After . or ?. a name is a property, even if it is spelled as a keyword
+    bool member = false;
+
+    bool regex_allowed = true;
+    size_t start;
+
+    while (i < n) {
+        switch (B(i)) {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\v':
+        case '\f':
+        case '\r':
+            i++;
+            continue;
+
+        case '/':
+            if (i + 1 < n && B(i + 1) == '/') {
+                while (i < n && B(i) != '\n' && B(i) != '\r')
+                    i++;
+                continue;
+            }
+
+            if (i + 1 < n && B(i + 1) == '*') {
+                for (i += 2; i + 1 < n; i++) {
+                    if (B(i) == '*' && B(i + 1) == '/')
+                        break;
+                }
+                if (i + 1 >= n)
+                    return -1;
+                i += 2;
+                continue;
+            }
+
+            if (!regex_allowed) {
+                i++;
+                regex_allowed = true;
+                break;
+            }
+
+            // Regular expression literal, where / is allowed in a class
+            for (bool class = false; ++i < n; ) {
+                if (B(i) == '\n' || B(i) == '\r')
+                    return -1;
+                if (B(i) == '\\')
+                    i++;
+                else if (B(i) == '[')
+                    class = true;
+                else if (B(i) == ']')
+                    class = false;
+                else if (B(i) == '/' && !class)
+                    break;
+            }
+            if (i >= n)
+                return -1;
+            for (i++; i < n && is_word_unit(B(i)); )
+                i++;
+            regex_allowed = false;
+            break;
+
+        case '"':
+        case '\'':
+            for (start = i++; i < n && B(i) != B(start); i++) {
+                if (B(i) == '\n' || B(i) == '\r')
+                    return -1;
+                if (B(i) == '\\')
+                    i++;
+            }
+            if (i >= n)
+                return -1;
+            i++;
+            regex_allowed = false;
+            break;
+
+        case '`':
+            i++;
+template:
+            switch (skip_template(ctx, &i, features)) {
+            case 0:
+                regex_allowed = false;
+                break;
+
+            case 1:
+                if (ntemplates == SKIP_TEMPLATE_DEPTH)
+                    return -1;
+                templates[ntemplates++] = depth;
+                regex_allowed = true;
+                break;
+
+            default:
+                return -1;
+            }
+            break;
+
+        case '{':
+            i++;
+            depth++;
+            regex_allowed = true;
+            break;
+
+        case '}':
+            i++;
+            if (ntemplates > 0 && templates[ntemplates - 1] == depth) {
+                ntemplates--;
+                goto template;
+            }
+            if (depth == 0) {
+                ctx->index = i;
+                return 0;
+            }
+            depth--;
+            regex_allowed = true;
+            break;
+
+        case '(':
+            i++;
+            if (parens < SKIP_PAREN_DEPTH) {
+                heads &= ~((uint64_t)1 << parens);
+                heads |= (uint64_t)condition << parens;
+            }
+            parens++;
+            regex_allowed = true;
+            break;
+
+        case ')':
+            i++;
+            regex_allowed = false;
+            if (parens > 0 && --parens < SKIP_PAREN_DEPTH)
+                regex_allowed = heads >> parens & 1;
+            break;
+
+        case ']':
+            i++;
+            regex_allowed = false;
+            break;
+
+        case '+':
+        case '-':
+            // ++ and -- leave it as it was: after an operand they are postfix
+            // and an operator follows, otherwise they are prefix
+            if (i + 1 < n && B(i + 1) == B(i)) {
+                i += 2;
+                break;
+            }
+            i++;
+            regex_allowed = true;
+            break;
+
+        case '.':
+        case '?':
+            // ?. is optional chaining unless a digit follows, as in a?.5:b
+            if (B(i) == '.' || (i + 1 < n && B(i + 1) == '.'
+                    && !(i + 2 < n && B(i + 2) >= '0' && B(i + 2) <= '9'))) {
+                i += B(i) == '.' ? 1 : 2;
+                regex_allowed = true;
+                condition = false;
+                member = true;
+                continue;
+            }
+            i++;
+            regex_allowed = true;
+            break;
+
+        default:
+            if (!is_word_unit(B(i))) {
+                i++;
+                regex_allowed = true;
+                break;
+            }
+
+            for (start = i; i < n && is_word_unit(B(i)); )
+                i++;
+            regex_allowed = !member && is_expression_keyword(ctx, start, i - start, features);
+            condition = !member && is_condition_keyword(ctx, start, i - start, features);
+
+            // of is only a keyword in the head of a for, elsewhere a name
+            if (!member && i - start == 2 && B(start) == 'o' && B(start + 1) == 'f'
+                    && parens > 0 && parens <= SKIP_PAREN_DEPTH)
+                regex_allowed = heads >> (parens - 1) & 1;
+            member = false;
+            continue;
+        }
+
+        // Any other token between a keyword and ( means it is not a head, and
+        // any token after a . is the property. Trivia and names skip this
+        // with continue.
+        condition = false;
+        member = false;
+    }
+
+    return -1;
+}
+
+#undef B
+
+// Skips a function body without producing tokens, for lazy parsing. Starting
+// right after a {, advances ctx->index to just past the matching }. Strings,
+// templates, regular expressions and comments are recognized so that braces
+// inside them are not counted. On unterminated input, returns -1 and leaves
+// ctx->index unchanged.
+int jz_skip_balanced(struct context *ctx)
+{
+    assert(ctx && ctx->bytes);
+
+    // Latin-1 is scanned like UTF-8, as only ASCII matters here
+    if (ctx->encoding == JZ_ENCODING_UTF16)
+        return skip_balanced(ctx, JZ_FEATURE_UTF16);
+    return skip_balanced(ctx, 0);
+}
+
+// Counts the line terminators between start and the current index, for input
+// that was skipped without looking at it
+static inline __attribute__((always_inline))
+void skip_lines(struct context *ctx, const size_t start, const unsigned features)
+{
+    const size_t end = ctx->index;
+    uint32_t c;
+    int size;
+
+    for (ctx->index = start; ctx->index < end; ) {
+        c = peek(ctx, features);
+
+        // CR LF is a single line terminator
+        if (c == '\r' && peek_offset(ctx, 1, features) == '\n')
+            ctx->index++;
+        if (c == '\n' || c == '\r') {
+            ctx->index++;
+            newline(ctx, features);
+            continue;
+        }
+
+        if (c < 0x80 || (c = peek_codepoint(ctx, &size, features)) == (uint32_t)-1) {
+            ctx->index++;
+            continue;
+        }
+
+        ctx->index += size;
+        if (is_line_terminator(c))
+            newline(ctx, features);
+    }
+
+    ctx->index = end;
+}
+
+// Turns the failed token at tok->start into a TOKEN_ERROR, and skips to where
+// tokenizing can safely continue:
+//   - numeric literals, identifiers and bad escapes to the end of the word
+//   - string literals to the closing quote or the end of the line
+//   - template literals to the closing `, past any substitutions
+//   - unterminated comments to the end of the input
+//   - anything else by one code point
+static inline __attribute__((always_inline))
+int recover(struct context *ctx, struct token *tok, const unsigned features)
+{
+    uint32_t c, quote;
+    size_t i;
+    int size, status;
+
+    if (ctx->error == JZ_ERROR_OUT_OF_MEMORY)
+        return -1;
+
+    ctx->index = tok->start;
+
+    switch (ctx->error) {
+    case JZ_ERROR_NUMERIC_LITERAL:
+        while (!is_end(ctx, (c = peek(ctx, features)), features)
+            && (is_word_unit(c) || c == '.'))
+            ctx->index++;
+        break;
+
+    case JZ_ERROR_INVALID_ESCAPE:
+        if (peek(ctx, features) == '#')
+            ctx->index++;
+
+        while (!is_end(ctx, (c = peek(ctx, features)), features) && is_word_unit(c)) {
+            ctx->index++;
+
+            // Include the braces of \u{...}
+            if (c == '\\' && peek(ctx, features) == 'u'
+                && peek_offset(ctx, 1, features) == '{') {
+                ctx->index += 2;
+                while (ishex(peek(ctx, features)))
+                    ctx->index++;
+                if (peek(ctx, features) == '}')
+                    ctx->index++;
+            }
+        }
+        break;
+
+    case JZ_ERROR_STRING_LITERAL:
+        quote = read(ctx, features);
+        while (!is_end(ctx, (c = peek(ctx, features)), features)) {
+            if (c == '\n' || c == '\r')
+                break;
+            ctx->index++;
+            if (c == quote)
+                break;
+
+            // Escaped line terminators continue the string
+            if (c == '\\' && !is_end(ctx, (c = peek(ctx, features)), features)) {
+                ctx->index++;
+                if (c == '\r' && peek(ctx, features) == '\n')
+                    ctx->index++;
+            }
+        }
+        break;
+
+    case JZ_ERROR_TEMPLATE_LITERAL:
+        // Substitutions may hold anything, including other templates
+        i = ctx->index + 1;
+        while ((status = skip_template(ctx, &i, features)) == 1) {
+            ctx->index = i;
+            if (jz_skip_balanced(ctx) < 0)
+                break;
+            i = ctx->index;
+        }
+        ctx->index = status == 0 ? i : ctx->size;
+        break;
+
+    case JZ_ERROR_UNTERMINATED_COMMENT:
+        ctx->index = ctx->size;
+        break;
+
+    default:
+        if (peek(ctx, features) < 0x80 || peek_codepoint(ctx, &size, features) == (uint32_t)-1)
+            size = 1;
+        ctx->index += size;
+        break;
+    }
+
+    skip_lines(ctx, tok->start, features);
+
+    tok->type = TOKEN_ERROR;
+    tok->error = ctx->error;
+
+    if (!vec_push(ctx->diagnostics, ((struct jz_diagnostic){
+            .start = tok->start,
+            .end = ctx->index,
+            .line = features & JZ_FEATURE_POSITION ? tok->line : 0,
+            .column = features & JZ_FEATURE_POSITION ? tok->column : 0,
+            .error = ctx->error }))) {
+        ctx->error = JZ_ERROR_OUT_OF_MEMORY;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Keywords are identifiers, told apart by their payload
+#define K(kw) \
+    (tok->type == TOKEN_IDENTIFIER && tok->id.len == sizeof(kw) \
+        && memcmp(tok->id.str, kw, sizeof(kw)) == 0)
+
+// Whether tok continues a statement after the } or ; that may have ended it
+static bool continues_statement(const struct jz_statements *st, const struct token *tok)
+{
+    if (tok->type == TOKEN_SEMICOLON)
+        return true;
+    return K("else") || K("catch") || K("finally") || (st->loop && K("while"));
+}
+
+// Statements that may end with the } of a block, or with the ; of a
+// statement in their body
+static bool is_compound_statement(const struct token *tok)
 {
-    assert(tok && tok->type < TOKEN_COUNT);
+    return tok->type == TOKEN_BRACE_LEFT || K("function") || K("class")
+        || K("if") || K("for") || K("while") || K("do") || K("try")
+        || K("switch") || K("with");
+}
 
-    printf("%s ", token_strings[tok->type]);
+// Identifiers that may end an expression, which excludes keywords that
+// expect something after them
+static bool ends_expression(const struct token *tok)
+{
+    return !(K("async") || K("await") || K("break") || K("case") || K("catch")
+        || K("class") || K("const") || K("continue") || K("default")
+        || K("delete") || K("do") || K("else") || K("enum") || K("export")
+        || K("extends") || K("finally") || K("for") || K("function")
+        || K("if") || K("import") || K("in") || K("instanceof") || K("let")
+        || K("new") || K("of") || K("return") || K("static") || K("switch")
+        || K("throw") || K("try") || K("typeof") || K("var") || K("void")
+        || K("while") || K("with") || K("yield"));
+}
+
+// Whether a line terminator before tok ends a statement, given that the
+// token before it may end an expression. That is when tok cannot continue
+// the expression, so automatic semicolon insertion applies.
+static bool begins_statement(const struct jz_statements *st, const struct token *tok)
+{
     switch (tok->type) {
     case TOKEN_IDENTIFIER:
-        fwrite(tok->id.str, 1, tok->id.len, stdout);
+        return !continues_statement(st, tok) && !K("in") && !K("instanceof")
+            && !K("of");
+
+    // A template after an expression is tagged by it
+    case TOKEN_ERROR:
+        return tok->error != JZ_ERROR_TEMPLATE_LITERAL;
+
+    case TOKEN_PLUS_PLUS:
+    case TOKEN_MINUS_MINUS:
+    case TOKEN_EXCLAMATION:
+    case TOKEN_TILDE:
+        return true;
+    }
+
+    return false;
+}
+
+// Advances the statement tracker past tok. Returns whether tok starts a new
+// top-level statement.
+static inline __attribute__((always_inline))
+bool statement_token(struct jz_statements *st, const struct token *tok)
+{
+    bool starts = false, block = false;
+
+    st->tokens++;
+    if (tok->type == TOKEN_EOF)
+        return false;
+
+    st->inserted = tok->newline_before
+        && (st->restricted || (st->ends && begins_statement(st, tok)));
+
+    if (st->depth == 0) {
+        if (!st->open)
+            starts = true;
+        else if (st->closed)
+            starts = !continues_statement(st, tok);
+        else
+            starts = st->inserted;
+    }
+
+    if (starts) {
+        st->open = true;
+        st->compound = is_compound_statement(tok);
+        st->loop = K("do");
+        st->function = K("function") || K("class");
+        st->head = false;
+        st->ending = false;
+    }
+    st->closed = false;
+
+    switch (tok->type) {
+    // Only the } of a body may end a statement, those of object literals in
+    // its expressions do not
+    case TOKEN_BRACE_LEFT:
+        if (st->depth == 0)
+            st->body = starts || st->block || st->function;
+        st->depth++;
+        st->ends = false;
+        break;
+
+    case TOKEN_PAREN_LEFT:
+        if (st->depth == 0 && st->condition)
+            st->head = true;
+        // fallthrough
+    case TOKEN_SQUARE_LEFT:
+        st->depth++;
+        st->ends = false;
+        break;
+
+    case TOKEN_PAREN_RIGHT:
+        if (st->depth > 0)
+            st->depth--;
+        st->ends = !(st->depth == 0 && st->head);
+        if (st->depth == 0 && st->head) {
+            block = true;
+            st->closed = st->ending;
+            st->head = false;
+            st->ending = false;
+        }
+        break;
+
+    case TOKEN_SQUARE_RIGHT:
+        if (st->depth > 0)
+            st->depth--;
+        st->ends = true;
+        break;
+
+    case TOKEN_BRACE_RIGHT:
+        if (st->depth > 0 && --st->depth == 0 && st->compound && st->body)
+            st->closed = true;
+        st->ends = true;
+        break;
+
+    case TOKEN_SEMICOLON:
+        if (st->depth == 0) {
+            if (st->compound)
+                st->closed = true;
+            else
+                st->open = false;
+        }
+        st->ends = false;
+        break;
+
+    case TOKEN_IDENTIFIER:
+        st->ends = ends_expression(tok);
+        break;
+
+    // Literals, which are still read as errors
+    case TOKEN_ERROR:
+        st->ends = true;
+        break;
+
+    // Postfix only if on the same line as its operand
+    case TOKEN_PLUS_PLUS:
+    case TOKEN_MINUS_MINUS:
+        st->ends = !tok->newline_before;
+        break;
+
+    default:
+        st->ends = false;
         break;
     }
-    printf("\n");
+
+    st->restricted = K("break") || K("continue") || K("return") || K("throw")
+        || K("yield");
+    st->block = block || (st->depth == 0 && (K("else") || K("do") || K("try")
+        || K("catch") || K("finally")));
+
+    // The ( after if, for, while, with, switch or catch is not a call, and
+    // the one after the while of a do ends the statement
+    if (st->depth == 0 && st->loop && K("while")) {
+        st->loop = false;
+        st->ending = true;
+        st->condition = true;
+    } else if (st->depth == 0 && (K("if") || K("for") || K("while") || K("with")
+            || K("switch") || K("catch")))
+        st->condition = true;
+    else if (!(st->condition && K("await")))
+        st->condition = false;
+
+    return starts;
+}
+
+#undef K
+
+static inline uint64_t fingerprint_mix(uint64_t h, const uint64_t x)
+{
+    h ^= x;
+    h *= 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+}
+
+static inline uint64_t fingerprint_bytes(uint64_t h, const uint8_t *bytes, size_t len)
+{
+    uint64_t x;
+
+    for (; len >= 8; bytes += 8, len -= 8) {
+        memcpy(&x, bytes, 8);
+        h = fingerprint_mix(h, x);
+    }
+
+    if (len > 0) {
+        x = 0;
+        memcpy(&x, bytes, len);
+        h = fingerprint_mix(h, x);
+    }
+
+    return h;
+}
+
+static inline uint64_t fingerprint_finish(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static int fingerprint_end_statement(struct jz_fingerprint *fp)
+{
+    const uint64_t h = fingerprint_finish(fp->statement);
+
+    fp->statement = 0;
+    fp->open = false;
+
+    if (fp->collect_statements && !vec_push(fp->statements, h))
+        return -1;
+    return 0;
+}
+
+// Folds tok into the file hash and the hash of the current top-level
+// statement, which ends before the token that starts the next one
+static inline __attribute__((always_inline))
+int fingerprint_token(struct context *ctx, const struct token *tok, const bool starts,
+    const unsigned features)
+{
+    struct jz_fingerprint *fp = &ctx->fingerprint;
+    const size_t width = features & JZ_FEATURE_UTF16 ? 2 : 1;
+    uint64_t h;
+
+    if (starts && fp->open && fingerprint_end_statement(fp) < 0)
+        return -1;
+
+    if (tok->type == TOKEN_EOF)
+        return fp->open ? fingerprint_end_statement(fp) : 0;
+
+    // Hashed once on its own, then folded into both
+    h = fingerprint_mix(0, (uint64_t)tok->type << 32 | tok->id.len);
+    if (tok->type == TOKEN_IDENTIFIER)
+        h = fingerprint_bytes(h, tok->id.str, tok->id.len);
+    else if (tok->type == TOKEN_ERROR)
+        h = fingerprint_bytes(h, &ctx->bytes[tok->start * width],
+            (tok->end - tok->start) * width);
+
+    // A break between statements belongs to neither of them
+    if (ctx->statements.inserted) {
+        fp->file = fingerprint_mix(fp->file, '\n');
+        if (!starts)
+            fp->statement = fingerprint_mix(fp->statement, '\n');
+    }
+
+    fp->file = fingerprint_mix(fp->file, h);
+    fp->statement = fingerprint_mix(fp->statement, h);
+    fp->open = true;
+
+    return 0;
+}
+
+static inline __attribute__((always_inline))
+int next_token_(struct context *ctx, struct token *tok, const unsigned features)
+{
+    int retval;
+
+    assert(ctx && ctx->bytes);
+    assert(!(features & (JZ_FEATURE_FINGERPRINT | JZ_FEATURE_STATEMENTS))
+        || ((features & JZ_FEATURE_PAYLOAD) && (features & JZ_FEATURE_TRIVIA)));
+    assert(ctx->encoding == (features & JZ_FEATURE_UTF16 ? JZ_ENCODING_UTF16
+        : features & JZ_FEATURE_LATIN1 ? JZ_ENCODING_LATIN1 : JZ_ENCODING_UTF8));
+
+#ifdef JZ_INSTRUMENT
+    const size_t trivia = ctx->index;
+    const size_t allocations = vec_allocations_;
+    const size_t icu_calls = icu_calls_;
+#endif
+
+    retval = skip_trivia(ctx, tok, features);
+    if (retval < 0 && !(features & JZ_FEATURE_RECOVER))
+        return -1;
+
+    tok->start = ctx->index;
+    if (features & JZ_FEATURE_POSITION) {
+        tok->line = ctx->line;
+        tok->column = ctx->index - ctx->line_start;
+    }
+    tok->id.str = NULL;
+    tok->id.len = 0;
+
+    if (retval == 0)
+        retval = scan_token(ctx, tok, features);
+    if (retval < 0 && (features & JZ_FEATURE_RECOVER))
+        retval = recover(ctx, tok, features);
+    tok->end = ctx->index;
+
+    if (retval == 0 && (features & (JZ_FEATURE_FINGERPRINT | JZ_FEATURE_STATEMENTS))) {
+        const size_t index = ctx->statements.tokens;
+        const bool starts = statement_token(&ctx->statements, tok);
+
+        if (((features & JZ_FEATURE_STATEMENTS) && starts
+                && !vec_push(ctx->statements.starts, index))
+            || ((features & JZ_FEATURE_FINGERPRINT)
+                && fingerprint_token(ctx, tok, starts, features) < 0)) {
+            vec_free(tok->id.str);
+            tok->id.str = NULL;
+            ctx->error = JZ_ERROR_OUT_OF_MEMORY;
+            retval = -1;
+        }
+    }
+
+#ifdef JZ_INSTRUMENT
+    STAT(ctx, bytes_trivia, tok->start - trivia);
+    STAT(ctx, allocations, vec_allocations_ - allocations);
+    STAT(ctx, icu_calls, icu_calls_ - icu_calls);
+
+    if (retval == 0) {
+        STAT(ctx, tokens[tok->type], 1);
+        if (tok->type == TOKEN_IDENTIFIER)
+            STAT(ctx, bytes_identifier, tok->end - tok->start);
+        else
+            STAT(ctx, bytes_punctuator, tok->end - tok->start);
+
+        if (ctx->trace)
+            ctx->trace(ctx, tok, ctx->trace_data);
+    }
+#endif
+
+    return retval;
+}
+
+#define V(name, features)                             \
+    int name(struct context *ctx, struct token *tok) \
+    {                                                 \
+        return next_token_(ctx, tok, features);       \
+    }
+
+JZ_TOKENIZER_LIST(V)
+
+#undef V
+
+// For entry points with JZ_FEATURE_SENTINEL, bytes must be followed by at
+// least JZ_PADDING zero bytes
+void jz_context_init_padded(struct context *ctx, const uint8_t *bytes, size_t size)
+{
+    jz_context_init(ctx, bytes, size);
+
+    for (size_t i = 0; i < JZ_PADDING; i++)
+        assert(bytes[size + i] == 0);
+}
+
+// Like jz_context_init_padded, but with a padded copy of bytes that is
+// released with jz_context_free
+int jz_context_init_copy(struct context *ctx, const uint8_t *bytes, size_t size)
+{
+    uint8_t *storage;
+
+    assert(bytes || size == 0);
+
+    if (size > SIZE_MAX - JZ_PADDING || !(storage = malloc(size + JZ_PADDING)))
+        return -1;
+    if (size > 0)
+        memcpy(storage, bytes, size);
+    memset(&storage[size], 0, JZ_PADDING);
+
+    jz_context_init(ctx, storage, size);
+    ctx->storage = storage;
+    return 0;
+}
+
+// Source stored as one byte per code point, tokenized with
+// jz_next_token_latin1
+void jz_context_init_latin1(struct context *ctx, const uint8_t *bytes, size_t size)
+{
+    jz_context_init(ctx, bytes, size);
+    ctx->encoding = JZ_ENCODING_LATIN1;
+}
+
+// Source stored as UTF-16 in host byte order, tokenized with
+// jz_next_token_utf16
+void jz_context_init_utf16(struct context *ctx, const uint16_t *units, size_t size)
+{
+    jz_context_init(ctx, (const uint8_t *)units, size);
+    ctx->encoding = JZ_ENCODING_UTF16;
+}
+
+void jz_context_free(struct context *ctx)
+{
+    assert(ctx);
+
+    free(ctx->storage);
+    ctx->storage = NULL;
+    vec_free(ctx->diagnostics);
+    ctx->diagnostics = NULL;
+    vec_free(ctx->fingerprint.statements);
+    ctx->fingerprint.statements = NULL;
+    vec_free(ctx->statements.starts);
+    ctx->statements.starts = NULL;
+    jz_arena_free(&ctx->arena);
+}
+
+void jz_context_init(struct context *ctx, const uint8_t *bytes, size_t size)
+{
+    assert(ctx && bytes);
+
+    ctx->encoding = JZ_ENCODING_UTF8;
+    ctx->storage = NULL;
+    ctx->diagnostics = NULL;
+    ctx->allocator = NULL;
+    jz_arena_init(&ctx->arena);
+    memset(&ctx->fingerprint, 0, sizeof(ctx->fingerprint));
+    memset(&ctx->statements, 0, sizeof(ctx->statements));
+
+#ifdef JZ_INSTRUMENT
+    ctx->trace = NULL;
+    ctx->trace_data = NULL;
+#endif
+
+    jz_context_reset(ctx, bytes, size);
+}
+
+// Starts over on new input, keeping the encoding, settings and the capacity
+// of every vector. Identifier payloads from ctx->arena are released, and
+// payloads from libc have to be released by the caller as usual.
+void jz_context_reset(struct context *ctx, const uint8_t *bytes, size_t size)
+{
+    assert(ctx && bytes);
+
+    ctx->bytes = bytes;
+    ctx->size = size;
+    ctx->index = 0;
+    ctx->line = 1;
+    ctx->line_start = 0;
+    ctx->error = JZ_ERROR_NONE;
+    vec_clear(ctx->diagnostics);
+    jz_arena_reset(&ctx->arena);
+
+    ctx->fingerprint = (struct jz_fingerprint){
+        .collect_statements = ctx->fingerprint.collect_statements,
+        .statements = ctx->fingerprint.statements,
+    };
+    vec_clear(ctx->fingerprint.statements);
+    ctx->statements = (struct jz_statements){
+        .starts = ctx->statements.starts,
+    };
+    vec_clear(ctx->statements.starts);
+
+#ifdef JZ_INSTRUMENT
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+#endif
+}
+
+// Contexts released on this thread, ready to be handed out again
+static _Thread_local struct context *context_pool[JZ_CONTEXT_POOL];
+static _Thread_local size_t context_pool_len;
+
+// A context for tokenizing bytes, from this thread's pool if it has one.
+// Identifier payloads are allocated from its arena: they are not released
+// with vec_free, and stay valid until the context is reset or released.
+// Returns NULL if out of memory.
+struct context *jz_context_acquire(const uint8_t *bytes, size_t size)
+{
+    struct context *ctx;
+
+    if (context_pool_len > 0) {
+        ctx = context_pool[--context_pool_len];
+        jz_context_reset(ctx, bytes, size);
+
+        // Settings are not carried over from whoever had it last
+        ctx->encoding = JZ_ENCODING_UTF8;
+        ctx->fingerprint.collect_statements = false;
+#ifdef JZ_INSTRUMENT
+        ctx->trace = NULL;
+        ctx->trace_data = NULL;
+#endif
+    } else {
+        if (!(ctx = malloc(sizeof(*ctx))))
+            return NULL;
+        jz_context_init(ctx, bytes, size);
+    }
+
+    ctx->allocator = &ctx->arena.allocator;
+    return ctx;
+}
+
+// Returns a context from jz_context_acquire to this thread's pool, or frees
+// it if the pool is full. It may be released on another thread than the one
+// it was acquired on.
+void jz_context_release(struct context *ctx)
+{
+    if (!ctx)
+        return;
+
+    // Only the buffers are worth keeping
+    free(ctx->storage);
+    ctx->storage = NULL;
+
+    if (context_pool_len < JZ_CONTEXT_POOL) {
+        context_pool[context_pool_len++] = ctx;
+        return;
+    }
+
+    jz_context_free(ctx);
+    free(ctx);
+}
+
+// Frees the contexts pooled on this thread, e.g. before it exits
+void jz_context_pool_clear(void)
+{
+    while (context_pool_len > 0) {
+        struct context *ctx = context_pool[--context_pool_len];
+
+        jz_context_free(ctx);
+        free(ctx);
+    }
+}
+
+const char *jz_error_string(enum jz_error error)
+{
+    static const char *messages[] = {
+#define F(x, s) s,
+        JZ_ERROR_LIST(F)
+#undef F
+    };
+
+    assert(error < sizeof(messages) / sizeof(*messages));
+    return messages[error];
+}
+
+// Hash of the tokens read so far with JZ_FEATURE_FINGERPRINT
+uint64_t jz_fingerprint(const struct context *ctx)
+{
+    assert(ctx);
+
+    return fingerprint_finish(ctx->fingerprint.file);
 }
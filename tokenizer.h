@@ -1,19 +1,251 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include "arena.h"
 #include "token.h"
 
+// Number of zero bytes that must follow the input for JZ_FEATURE_SENTINEL
+#define JZ_PADDING 64
+
+#ifdef JZ_INSTRUMENT
+#include <stdio.h>
+
+// Counters collected per context when built with JZ_INSTRUMENT
+struct jz_stats
+{
+    size_t tokens[TOKEN_COUNT];
+
+    // Bytes consumed by category
+    size_t bytes_trivia;
+    size_t bytes_identifier;
+    size_t bytes_punctuator;
+
+    size_t codepoints;  // Non-ASCII code points decoded
+    size_t escapes;     // Escape sequences read
+    size_t allocations; // Allocations from vec_realloc_
+    size_t icu_calls;
+    size_t slow_paths;  // Fallbacks from the ASCII fast paths
+};
+#endif
+
+// F(name, message), reasons for a failed token or a TOKEN_ERROR
+#define JZ_ERROR_LIST(F) \
+    F(NONE,                 "no error") \
+    F(OUT_OF_MEMORY,        "out of memory") \
+    F(INVALID_CHARACTER,    "invalid or unexpected character") \
+    F(INVALID_ESCAPE,       "invalid escape sequence in identifier") \
+    F(UNTERMINATED_COMMENT, "unterminated comment") \
+    F(NUMERIC_LITERAL,      "numeric literals are not supported") \
+    F(STRING_LITERAL,       "string literals are not supported") \
+    F(TEMPLATE_LITERAL,     "template literals are not supported") \
+    F(INVALID_STRING,       "invalid string literal") \
+    F(INVALID_NUMBER,       "invalid numeric literal")
+
+enum jz_error
+{
+#define F(x, s) JZ_ERROR_##x,
+    JZ_ERROR_LIST(F)
+#undef F
+};
+
+// Malformed input skipped by JZ_FEATURE_RECOVER, as a span of code units
+struct jz_diagnostic
+{
+    size_t start;
+    size_t end;
+    size_t line;
+    size_t column;
+    enum jz_error error;
+};
+
+// Hashes of the tokens seen so far, see JZ_FEATURE_FINGERPRINT
+struct jz_fingerprint
+{
+    uint64_t file;
+    uint64_t statement; // Of the current top-level statement
+    bool open;          // Whether the current statement has tokens
+
+    // Vector of hashes of finished top-level statements, split as with
+    // JZ_FEATURE_STATEMENTS, only collected if collect_statements is set
+    bool collect_statements;
+    uint64_t *statements;
+};
+
+// Where top-level statements start, see JZ_FEATURE_STATEMENTS
+struct jz_statements
+{
+    size_t tokens; // Read so far, so the index of the next one
+
+    // Nesting depth of brackets, and the state of the current statement
+    size_t depth;
+    bool open;       // Has tokens that are not yet ended by a ;
+    bool compound;   // Starts with a { or a keyword such as if or function
+    bool loop;       // Starts with do, so a while after its block continues it
+    bool closed;     // May have ended with the } of its outermost block
+    bool function;   // Starts with function or class, so its { is the body
+    bool block;      // The last token leads a body, such as else or if (a)
+    bool body;       // The open top-level { is a body, not an object literal
+    bool condition;  // The last token was if, for, while or with
+    bool head;       // In a top-level ( that follows one of those
+    bool ending;     // The ( is the condition that ends a do statement
+    bool ends;       // The last token may end an expression
+    bool restricted; // The last token was break, continue, return, throw or yield
+    bool inserted;   // A semicolon is inserted at the line break before it
+
+    // Vector of the index of the first token of every top-level statement,
+    // released with jz_context_free
+    size_t *starts;
+};
+
+enum jz_encoding
+{
+    JZ_ENCODING_UTF8,
+    JZ_ENCODING_LATIN1,
+    JZ_ENCODING_UTF16,
+};
+
+// Sizes, indices and token spans are counted in code units of the encoding:
+// bytes for UTF-8 and Latin-1, 16-bit units for UTF-16. Identifier payloads
+// are always UTF-8.
 struct context
 {
-    const uint8_t *bytes;
+    union {
+        const uint8_t *bytes;
+        const uint16_t *units;
+    };
     size_t size;
     size_t index;
+    enum jz_encoding encoding;
+
+    // Current line and the index it starts at, see JZ_FEATURE_POSITION
+    size_t line;
+    size_t line_start;
+
+    // Padded copy of the input owned by the context, see jz_context_init_copy
+    uint8_t *storage;
+
+    // Why the last failed token failed
+    enum jz_error error;
+
+    // Where identifier payloads are allocated, libc if NULL. Pooled contexts
+    // use their arena, see jz_context_acquire.
+    const struct vec_allocator *allocator;
+    struct jz_arena arena;
+
+    // Vector of everything skipped with JZ_FEATURE_RECOVER, in source order,
+    // released with jz_context_free
+    struct jz_diagnostic *diagnostics;
+
+    struct jz_fingerprint fingerprint;
+    struct jz_statements statements;
+
+#ifdef JZ_INSTRUMENT
+    struct jz_stats stats;
+
+    // Called after every token
+    void (*trace)(const struct context *ctx, const struct token *tok, void *data);
+    void *trace_data;
+#endif
 };
 
-int next_token(struct context *ctx, struct token *tok);
+// Optional work done by a tokenizer entry point. Token fields that belong to
+// a disabled feature are left untouched. Entry points with different
+// features should not be mixed on one context.
+#define JZ_FEATURE_PAYLOAD     (1u << 0) // Decode identifier names into tok->id
+#define JZ_FEATURE_TRIVIA      (1u << 1) // Set tok->trivia and tok->newline_before
+#define JZ_FEATURE_POSITION    (1u << 2) // Set tok->line and tok->column
+#define JZ_FEATURE_SENTINEL    (1u << 3) // Input is padded, see jz_context_init_padded
+#define JZ_FEATURE_LATIN1      (1u << 4) // Input is Latin-1, see jz_context_init_latin1
+#define JZ_FEATURE_UTF16       (1u << 5) // Input is UTF-16, see jz_context_init_utf16
+#define JZ_FEATURE_RECOVER     (1u << 6) // Emit TOKEN_ERROR instead of failing
+#define JZ_FEATURE_FINGERPRINT (1u << 7) // Hash tokens into ctx->fingerprint
+#define JZ_FEATURE_STATEMENTS  (1u << 8) // Index statements in ctx->statements
+
+// With JZ_FEATURE_SENTINEL, the end of the input is found by its zero
+// padding instead of by bounds checks. That only pays off when scanning is
+// most of the work: jz_next_token_span_padded is up to about 15% faster than
+// jz_next_token_span, while jz_next_token_padded measures within noise of
+// next_token, as decoding payloads and tracking positions dominate there.
+// Most of the speed of the span entry points comes from leaving out those
+// features, not from the padding.
+//
+// With JZ_FEATURE_RECOVER, malformed or unsupported input becomes a
+// TOKEN_ERROR that spans it, is recorded in ctx->diagnostics, and tokenizing
+// continues after it. Only running out of memory still fails.
+//
+// With JZ_FEATURE_FINGERPRINT, the type and decoded payload of every token is
+// folded into a hash, so two inputs that differ only in whitespace, comments
+// or escapes in identifiers get the same one. Error tokens are hashed by their
+// source text. Line breaks are hashed where automatic semicolon insertion
+// applies, as found for JZ_FEATURE_STATEMENTS but at any depth, so return\nx
+// and return x differ. Breaks anywhere else are not seen.
+//
+// With JZ_FEATURE_STATEMENTS, the index of the first token of every
+// top-level statement is pushed to ctx->statements.starts, so that a parser
+// can hand statements to different threads. A statement runs up to the next
+// start, or up to TOKEN_EOF for the last one. Statements are split where the
+// bracket depth is zero: after a ;, after the } of the outermost block of a
+// compound statement such as if or function, and at a line terminator where
+// automatic semicolon insertion applies. The last one is approximated from
+// the tokens on either side of it, and where in doubt statements are not
+// split, so a statement may hold several but one is never cut in two.
+
+#define JZ_FEATURES_ALL \
+    (JZ_FEATURE_PAYLOAD | JZ_FEATURE_TRIVIA | JZ_FEATURE_POSITION)
+
+// Every entry point takes time linear in the input, whatever the input is.
+// Each code unit is looked at a bounded number of times: error recovery only
+// rescans the failed token, and template nesting is tracked to a fixed depth.
+// Nothing recurses, and memory beyond the input grows by a constant per
+// token: identifier payloads are at most four bytes per code unit of their
+// source, and each TOKEN_ERROR adds one struct jz_diagnostic. The same goes
+// for jz_skip_balanced and the JSON lexer, and all three are checked with
+// pathological inputs by the adversarial benchmark.
+
+// V(name, features), each one expands to a tokenizer entry point with the
+// given features compiled in and everything else compiled out
+#define JZ_TOKENIZER_LIST(V) \
+    V(next_token,                JZ_FEATURES_ALL) \
+    V(jz_next_token_payload,     JZ_FEATURE_PAYLOAD) \
+    V(jz_next_token_span,        0) \
+    V(jz_next_token_padded,      JZ_FEATURES_ALL | JZ_FEATURE_SENTINEL) \
+    V(jz_next_token_span_padded, JZ_FEATURE_SENTINEL) \
+    V(jz_next_token_latin1,      JZ_FEATURES_ALL | JZ_FEATURE_LATIN1) \
+    V(jz_next_token_utf16,       JZ_FEATURES_ALL | JZ_FEATURE_UTF16) \
+    V(jz_next_token_recover,     JZ_FEATURES_ALL | JZ_FEATURE_RECOVER) \
+    V(jz_next_token_fingerprint, JZ_FEATURES_ALL | JZ_FEATURE_RECOVER | JZ_FEATURE_FINGERPRINT) \
+    V(jz_next_token_statements,  JZ_FEATURES_ALL | JZ_FEATURE_RECOVER | JZ_FEATURE_STATEMENTS)
+
+#define V(name, features) int name(struct context *ctx, struct token *tok);
+JZ_TOKENIZER_LIST(V)
+#undef V
+
+void jz_context_init(struct context *ctx, const uint8_t *bytes, size_t size);
+void jz_context_init_padded(struct context *ctx, const uint8_t *bytes, size_t size);
+int jz_context_init_copy(struct context *ctx, const uint8_t *bytes, size_t size);
+void jz_context_init_latin1(struct context *ctx, const uint8_t *bytes, size_t size);
+void jz_context_init_utf16(struct context *ctx, const uint16_t *units, size_t size);
+void jz_context_free(struct context *ctx);
+void jz_context_reset(struct context *ctx, const uint8_t *bytes, size_t size);
+
+// Number of released contexts kept per thread by jz_context_release
+#define JZ_CONTEXT_POOL 16
+
+struct context *jz_context_acquire(const uint8_t *bytes, size_t size);
+void jz_context_release(struct context *ctx);
+void jz_context_pool_clear(void);
 void print_token(struct token *tok);
+const char *jz_error_string(enum jz_error error);
+uint64_t jz_fingerprint(const struct context *ctx);
+
+int jz_skip_balanced(struct context *ctx);
+
+#ifdef JZ_INSTRUMENT
+void jz_stats_dump(const struct context *ctx, FILE *fp);
+#endif
 
 #endif // COMMON_H_
@@ -9,12 +9,26 @@
 // vec_end
 // vec_at
 
+// vec_new
+// vec_inline
+// vec_init_inline
+
 // vec_push
+// vec_append
 // vec_pop
+// vec_reserve
+// vec_resize
 // vec_clear
 // vec_free
 
+// Growing a vector can fail, in which case vec_push evaluates to NULL,
+// vec_new leaves the vector NULL, vec_append, vec_reserve and vec_resize
+// return -1, and the vector is left as it was.
+
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define vec_empty(v) ((v) ? vec_len(v) == 0 : 1)
 #define vec_len(v) ((v) ? vec_header_(v)->len : 0)
@@ -23,49 +37,218 @@
 #define vec_begin(v) (v)
 #define vec_end(v) ((v) ? (v) + vec_len(v) - 1 : NULL)
 
-#define vec_push(v, item) ({             \
-    vec_maybegrow_(v, 1);                \
-    (v)[vec_header_(v)->len++] = (item); \
-    vec_end(v); })
-
-#define vec_free(v) ((v) ? free(vec_header_(v)) : 0)
+// Creates an empty vector for cap items, with storage from allocator, or
+// from libc if it is NULL
+#define vec_new(v, allocator, cap) \
+    ((v) = vec_new_((allocator), (cap), sizeof(*(v))))
+
+// Storage for a vector of up to n items, e.g. on the stack. Pushing past n
+// items moves the vector to allocated storage.
+#define vec_inline(type, n)       \
+    struct {                      \
+        struct vec_header header; \
+        type items[n];            \
+    }
+
+#define vec_init_inline(v, storage) vec_init_inline_from(v, NULL, storage)
+
+// Like vec_init_inline, but moves to storage from allocator when it grows
+#define vec_init_inline_from(v, allocator, storage)         \
+    ((v) = vec_init_inline_(&(storage).header, (allocator), \
+        sizeof((storage).items) / sizeof(*(storage).items)))
+
+#define vec_push(v, item) ({                 \
+    __typeof__(v) vec_item_ = NULL;          \
+    if (vec_maybegrow_(v, 1) == 0) {         \
+        (v)[vec_header_(v)->len++] = (item); \
+        vec_item_ = vec_end(v);              \
+    }                                        \
+    vec_item_; })
+
+#define vec_append(v, items, n) ({                                \
+    size_t vec_n_ = (n);                                          \
+    int vec_status_ = vec_maybegrow_(v, vec_n_);                  \
+    if (vec_status_ == 0 && vec_n_ > 0) {                         \
+        memcpy(&(v)[vec_len(v)], (items), vec_n_ * sizeof(*(v))); \
+        vec_header_(v)->len += vec_n_;                            \
+    }                                                             \
+    vec_status_; })
+
+#define vec_reserve(v, n) ({                                   \
+    int vec_status_ = 0;                                       \
+    if (vec_cap(v) < (n)) {                                    \
+        void *vec_tmp_ = vec_realloc_((v), (n), sizeof(*(v))); \
+        if (vec_tmp_)                                          \
+            (v) = vec_tmp_;                                    \
+        else                                                   \
+            vec_status_ = -1;                                  \
+    }                                                          \
+    vec_status_; })
+
+// New items are left uninitialized
+#define vec_resize(v, n) ({                     \
+    size_t vec_len_ = (n);                      \
+    int vec_status_ = vec_reserve(v, vec_len_); \
+    if (vec_status_ == 0 && (v))                \
+        vec_header_(v)->len = vec_len_;         \
+    vec_status_; })
+
+#define vec_clear(v) ((v) ? (void)(vec_header_(v)->len = 0) : (void)0)
+#define vec_free(v) vec_free_(v)
 
 #define vec_header_(v) ((struct vec_header *)(v) - 1)
-#define vec_maybegrow_(v, add_len)                         \
-    (!(v) || vec_cap(v) < vec_len(v) + (add_len)           \
-        ? (v) = vec_realloc_((v), (add_len), sizeof(*(v))) \
-        : 0)
+#define vec_maybegrow_(v, add_len) ({                               \
+    int vec_status_ = 0;                                            \
+    if (!(v) || vec_cap(v) < vec_len(v) + (add_len)) {              \
+        size_t vec_cap_ = calculate_capacity_(vec_cap(v));          \
+        if (vec_cap_ > VEC_MAX_)                                    \
+            vec_cap_ = VEC_MAX_;                                    \
+        if (vec_cap_ < vec_len(v) + (add_len))                      \
+            vec_cap_ = vec_len(v) + (add_len);                      \
+        void *vec_tmp_ = vec_realloc_((v), vec_cap_, sizeof(*(v))); \
+        if (vec_tmp_)                                               \
+            (v) = vec_tmp_;                                         \
+        else                                                        \
+            vec_status_ = -1;                                       \
+    }                                                               \
+    vec_status_; })
+
+// Storage for vectors, e.g. an arena or a thread-local pool. realloc is
+// called with a NULL ptr to allocate, and must return NULL on failure.
+struct vec_allocator
+{
+    void *(*realloc)(void *data, void *ptr, size_t old_size, size_t new_size);
+    void (*free)(void *data, void *ptr);
+    void *data;
+};
 
+// Kept to 16 bytes, as short identifier payloads are vectors too. Vectors
+// hold at most VEC_MAX_ items.
 struct vec_header
 {
-    size_t len;
-    size_t cap;
+    uint32_t len;
+    uint32_t cap : 31;
+    uint32_t inline_ : 1;
+
+    const struct vec_allocator *allocator;
 };
 
+#define VEC_MAX_ 0x7fffffffu
+
+#ifdef JZ_INSTRUMENT
+// Number of calls to vec_realloc_ on the current thread
+extern _Thread_local size_t vec_allocations_;
+#endif
+
 static inline
 size_t calculate_capacity_(size_t cap)
 {
-    if (cap < 2)
-        return 2;
+    if (cap < 8)
+        return 8;
 
     return cap + (cap >> 1) + (cap >> 3);
 }
 
 static inline
-void *vec_realloc_(void *v, size_t add_len, size_t width)
+void *vec_alloc_(const struct vec_allocator *allocator, void *ptr,
+    size_t old_size, size_t new_size)
 {
-    size_t new_cap = vec_cap(v);
-    while (new_cap < vec_len(v) + add_len)
-        new_cap = calculate_capacity_(new_cap);
+    if (allocator)
+        return allocator->realloc(allocator->data, ptr, old_size, new_size);
+    return realloc(ptr, new_size);
+}
 
-    struct vec_header *tmp = realloc(v ? vec_header_(v) : NULL,
-        sizeof(*tmp) + (new_cap * width));
+static inline
+void *vec_init_inline_(struct vec_header *header,
+    const struct vec_allocator *allocator, size_t cap)
+{
+    header->len = 0;
+    header->cap = cap;
+    header->allocator = allocator;
+    header->inline_ = 1;
 
-    if (!v)
+    return header + 1;
+}
+
+static inline
+void *vec_realloc_(void *v, size_t new_cap, size_t width)
+{
+    struct vec_header *header = v ? vec_header_(v) : NULL;
+    struct vec_header *tmp;
+    size_t size;
+
+#ifdef JZ_INSTRUMENT
+    vec_allocations_++;
+#endif
+
+    if (new_cap > VEC_MAX_ || new_cap > (SIZE_MAX - sizeof(*tmp)) / width)
+        return NULL;
+    size = sizeof(*tmp) + (new_cap * width);
+
+    if (header && header->inline_) {
+        // Inline storage is not owned, so copy out of it
+        if (!(tmp = vec_alloc_(header->allocator, NULL, 0, size)))
+            return NULL;
+        memcpy(tmp, header, sizeof(*tmp) + (header->len * width));
+        tmp->inline_ = 0;
+    } else if (header) {
+        tmp = vec_alloc_(header->allocator, header,
+            sizeof(*tmp) + (header->cap * width), size);
+        if (!tmp)
+            return NULL;
+    } else {
+        if (!(tmp = realloc(NULL, size)))
+            return NULL;
         tmp->len = 0;
+        tmp->allocator = NULL;
+        tmp->inline_ = 0;
+    }
+
     tmp->cap = new_cap;
+    return tmp + 1;
+}
+
+static inline
+void *vec_new_(const struct vec_allocator *allocator, size_t cap, size_t width)
+{
+    struct vec_header *tmp;
+    size_t size;
+
+    if (cap > VEC_MAX_ || cap > (SIZE_MAX - sizeof(*tmp)) / width)
+        return NULL;
+    size = sizeof(*tmp) + (cap * width);
+
+#ifdef JZ_INSTRUMENT
+    vec_allocations_++;
+#endif
+
+    if (!(tmp = vec_alloc_(allocator, NULL, 0, size)))
+        return NULL;
+
+    tmp->len = 0;
+    tmp->cap = cap;
+    tmp->allocator = allocator;
+    tmp->inline_ = 0;
+
+    return tmp + 1;
+}
+
+static inline
+void vec_free_(void *v)
+{
+    struct vec_header *header;
+
+    if (!v)
+        return;
+
+    header = vec_header_(v);
+    if (header->inline_)
+        return;
 
-    return (char *)tmp + sizeof(*tmp);
+    if (header->allocator && header->allocator->free)
+        header->allocator->free(header->allocator->data, header);
+    else if (!header->allocator)
+        free(header);
 }
 
 #endif // VEC_H_